@@ -92,6 +92,54 @@ typedef int (*Rfmalloc_register_matmul_backend_ex_fun)(const char *name,
                                                        Rfmalloc_gemm_fn fn,
                                                        Rfmalloc_typed_gemm_fn typed_fn);
 
+/*
+ * Codec-native product. A codec can multiply its own packed payload by a
+ * dense operand, with the typed backend hook's contract minus the codec name:
+ * C = T x D when typed_on_left, else C = D x T; return 0 if handled, non-zero
+ * to decline. Rfmalloc tries a selected backend's typed hook first, then this,
+ * then decodes panels for dgemm. The function must not call the R API; it may
+ * run its own threads. Register with Rfmalloc_register_tensor_codec_ex
+ * (product may be NULL, which is Rfmalloc_register_tensor_codec).
+ */
+typedef int (*Rfmalloc_tensor_product_fn)(const void *payload, size_t payload_bytes,
+                                          int tensor_nrow, int tensor_ncol,
+                                          int typed_on_left,
+                                          const double *dense, int dense_nrow,
+                                          int dense_ncol, double *C);
+typedef int (*Rfmalloc_register_tensor_codec_ex_fun)(const char *name,
+                                                     unsigned int items_per_block,
+                                                     unsigned int bytes_per_block,
+                                                     Rfmalloc_tensor_decode_fn decode,
+                                                     Rfmalloc_tensor_product_fn product);
+
+/*
+ * Codec extent. A codec whose payload is a small handle to data held
+ * elsewhere (a file another package reads on decode) reports how many bytes
+ * the payload addresses, so Rfmalloc's length checks measure the data rather
+ * than the handle. Return 0 for a malformed payload. Such a payload is never
+ * treated as fixed-geometry, so its pages are not evicted after a decode.
+ * Register after the codec itself; returns 0, or -1 for an unknown codec.
+ */
+typedef size_t (*Rfmalloc_tensor_extent_fn)(const void *payload, size_t payload_bytes);
+typedef int (*Rfmalloc_register_tensor_codec_extent_fun)(const char *name,
+                                                         Rfmalloc_tensor_extent_fn extent);
+
+/*
+ * Codec error reason. After a decode returns non-zero, Rfmalloc asks the
+ * codec why: the function writes a message for that payload's last failure
+ * into buf and returns 0, or returns -1 when it has none. The message is
+ * appended to the R error. Register after the codec itself; returns 0, or -1
+ * for an unknown codec.
+ *
+ * Unregistering removes a codec, e.g. from the registering package's
+ * .onUnload; tensors that name it then fail as an unknown codec. Returns 0,
+ * or -1 for an unknown codec.
+ */
+typedef int (*Rfmalloc_tensor_error_fn)(const void *payload, char *buf, size_t buf_len);
+typedef int (*Rfmalloc_register_tensor_codec_error_fun)(const char *name,
+                                                        Rfmalloc_tensor_error_fn error);
+typedef int (*Rfmalloc_unregister_tensor_codec_fun)(const char *name);
+
 /*
  * Streaming decode primitive. Decode a flat, block-aligned
  * element range [elem_offset, elem_offset + n_elems) of a typed tensor into a
@@ -101,7 +149,8 @@ typedef int (*Rfmalloc_register_matmul_backend_ex_fun)(const char *name,
  * (a standardized 'bed'/'dosage' payload decodes centred/scaled and
  * mean-imputed), so no flag is needed: pass a standardized tensor to stream
  * standardized values. 'tensor' is the fmalloc tensor object (the ALTREP
- * payload with its 'rfm_dtype' and 'dim' attributes). Returns 0 on success and
+ * payload with its 'rfm_dtype' and 'dim' attributes, or a chunk-indexed list
+ * of payloads; ranges may cross its parts). Returns 0 on success and
  * non-zero on any error; it never calls Rf_error.
  */
 typedef int (*Rfmalloc_tensor_decode_range_fun)(SEXP tensor, R_xlen_t elem_offset,
@@ -110,12 +159,58 @@ typedef int (*Rfmalloc_tensor_decode_range_fun)(SEXP tensor, R_xlen_t elem_offse
 /* Record-panel transfer context. Sources provide semantic records while
  * Rfmalloc owns allocation, packing, alignment, and persistent layout. This
  * is the same interface for plain f64, packed hardcalls, fixed-point dosage,
- * and locus-major haplotype bits. */
+ * and locus-major haplotype bits. Storage "dosage16" keeps pgenlib's 16-bit
+ * dosage units and also accepts RFMALLOC_BUFFER_PGEN_DOSAGE16 records, whose
+ * data is an array of struct Rfmalloc_buffer_dosage16 (record_stride apart)
+ * holding PgrGetD() output as is: no conversion to double on the way in.
+ * Storage "bed" also takes packed hardcalls: RFMALLOC_BUFFER_PGEN_GENOVEC
+ * records are pgenlib genovecs (PgrGet() output, 2 bits per sample: 0/1/2
+ * alt copies, 3 missing), recoded a machine word at a time, and
+ * RFMALLOC_BUFFER_PLINK1_BED records are variant blocks of a SNP-major
+ * PLINK 1 .bed, copied as is. record_stride is at least ceil(n_item / 4).
+ * Storage "haplotype_compressed" takes RFMALLOC_BUFFER_PACKED_BITS rows like
+ * "haplotype" but writes the compressed haplotype store: records must arrive
+ * in order, and finish returns R_NilValue (leaving the context to abort)
+ * until all of them have, and may call Rf_error if the runtime cannot hold
+ * the sealed store. Storages "alp" and "sparse" take RFMALLOC_BUFFER_F64
+ * records and write the payload of the tensor codec of that name, its
+ * elements being the records in order, n_item each. They are encoded 1024
+ * elements at a time as the records arrive, so memory stays at the encoded
+ * size plus two chunks per writer. Records written through one handle, or
+ * through Rfmalloc_buffer_write, must arrive in order. Finish returns
+ * R_NilValue (leaving the context to abort) until every record is written,
+ * may call Rf_error if the runtime cannot hold the payload, and sets its
+ * "rfm_nonfinite" attribute to whether any value is NA, NaN or infinite.
+ * Opening with n_record = 0 makes the context appendable, for sources that
+ * do not know their record count up front (a streamed VCF, a filtered PGEN).
+ * Storages "bed", "dosage", "dosage16", "alp", "sparse" and
+ * "haplotype_compressed" take it. Records are then written in order through
+ * Rfmalloc_buffer_write, each call starting where the last one ended.
+ * "bed" and the dosage storages fill extents that double from 1MB up to 1GB
+ * and never move a record while they fill. Finish trims the last extent,
+ * copying its records into a payload of their own size when that frees 1MB
+ * or more, and returns the payload when one extent was used, or else a
+ * chunk-indexed list of the extents' payloads with a double "rfm_part_cols"
+ * attribute of their record counts, which create_fmalloc_tensor() takes as
+ * is. An appendable context with no records finishes to R_NilValue,
+ * leaving it to abort. */
 struct Rfmalloc_buffer_context;
 enum Rfmalloc_buffer_source_type {
     RFMALLOC_BUFFER_I32 = 1,
     RFMALLOC_BUFFER_F64 = 2,
-    RFMALLOC_BUFFER_PACKED_BITS = 3
+    RFMALLOC_BUFFER_PACKED_BITS = 3,
+    RFMALLOC_BUFFER_PGEN_DOSAGE16 = 4,
+    RFMALLOC_BUFFER_PGEN_GENOVEC = 5,
+    RFMALLOC_BUFFER_PLINK1_BED = 6
+};
+/* genovec: 2 bits per sample (0/1/2 alt copies, 3 missing); dosage_present:
+ * 1 bit per sample; dosage_main: dosage_ct values in 1/16384 allele units for
+ * the present samples, in order. Bit layouts are pgenlib's. */
+struct Rfmalloc_buffer_dosage16 {
+    const void *genovec;
+    const void *dosage_present;
+    const uint16_t *dosage_main;
+    uint32_t dosage_ct;
 };
 typedef struct Rfmalloc_buffer_context *(*Rfmalloc_buffer_open_fun)(
     SEXP runtime, const char *storage, R_xlen_t n_item, R_xlen_t n_record);
@@ -126,12 +221,37 @@ typedef int (*Rfmalloc_buffer_write_fun)(
 typedef SEXP (*Rfmalloc_buffer_finish_fun)(struct Rfmalloc_buffer_context *ctx);
 typedef void (*Rfmalloc_buffer_abort_fun)(struct Rfmalloc_buffer_context *ctx);
 
+/* Parallel writers. Every storage except "haplotype_compressed" can hand out
+ * writer handles over disjoint record ranges of an open context, so worker
+ * threads can fill them at once. writer_open returns NULL for a range that
+ * overlaps one handed out before, or that the storage cannot take.
+ * writer_write takes the same arguments as Rfmalloc_buffer_write, with
+ * first_record absolute and confined to the handle's range. Opening,
+ * writing through, and closing a handle never call the R API and are safe
+ * from any thread; only writes through one handle must not run concurrently.
+ * Finish returns R_NilValue, leaving the context open, while a handle is
+ * still open; abort frees open handles with the context. Call either only
+ * once the workers have stopped. Appendable contexts hand out no handles. */
+struct Rfmalloc_buffer_writer;
+typedef struct Rfmalloc_buffer_writer *(*Rfmalloc_buffer_writer_open_fun)(
+    struct Rfmalloc_buffer_context *ctx, R_xlen_t first_record,
+    R_xlen_t n_record);
+typedef int (*Rfmalloc_buffer_writer_write_fun)(
+    struct Rfmalloc_buffer_writer *writer, R_xlen_t first_record,
+    R_xlen_t n_record, int source_type, const void *data,
+    size_t record_stride);
+typedef void (*Rfmalloc_buffer_writer_close_fun)(
+    struct Rfmalloc_buffer_writer *writer);
+
 /* Direct read-only view of the locus-major phased-haplotype store. The caller
  * must keep `store` reachable while using `data`. Row `locus` begins at
  * data + locus * stride and carries n_haplotype bits, least-significant bit
  * first within each byte. row_bytes excludes zero padding, while stride
  * includes it. The body and every row are 64-byte aligned, so a SIMD HMM
- * cache can borrow them without repacking. */
+ * cache can borrow them without repacking. A subset view
+ * (fmalloc_hap_subset()) of consecutive loci and all haplotypes returns the
+ * parent's rows from its first locus; any other view returns its compacted
+ * cache, built on first use, or -1 if that build fails. */
 struct Rfmalloc_haplotype_view {
     const uint8_t *data;
     R_xlen_t n_locus;
@@ -142,6 +262,82 @@ struct Rfmalloc_haplotype_view {
 typedef int (*Rfmalloc_haplotypes_data_fun)(
     SEXP store, struct Rfmalloc_haplotype_view *view);
 
+/* Readers of either haplotype store kind. A compressed store
+ * (fmalloc_haplotypes(compress = TRUE)) keeps each locus row as its smallest
+ * of a bit row, the minor-allele positions, or run lengths, and has no direct
+ * view: Rfmalloc_haplotypes_data() returns -1 for it.
+ *   - Rfmalloc_hap_rows: decode loci [first, first + n) into bit rows
+ *     dst_stride >= ceil(n_haplotype / 8) bytes apart, padding bits zero.
+ *   - Rfmalloc_hap_allele_counts: the ones in each of those loci (margin 1,
+ *     counts[n]) or in each haplotype over them (margin 2,
+ *     counts[n_haplotype]), read from the compressed records directly.
+ * Both return 0 or -1, split the loci over fmalloc_threads(), and never call
+ * Rf_error. */
+typedef int (*Rfmalloc_hap_rows_fun)(SEXP store, R_xlen_t first, R_xlen_t n,
+                                     uint8_t *dst, size_t dst_stride);
+typedef int (*Rfmalloc_hap_allele_counts_fun)(SEXP store, R_xlen_t first,
+                                              R_xlen_t n, int margin,
+                                              R_xlen_t *counts);
+
+/*
+ * Positional Burrows-Wheeler transform (PBWT) index of a haplotype store,
+ * built by fmalloc_pbwt(). Loci and haplotypes are 0-based, and a match
+ * [start, end) covers loci start .. end - 1.
+ *   - Rfmalloc_pbwt_build: index `haplotypes`, keeping the prefix and
+ *     divergence arrays every `interval` loci (0: never); returns the ALTREP
+ *     raw payload SEXP - PROTECT it. Calls Rf_error on bad input.
+ *   - Rfmalloc_pbwt_arrays: the prefix array a_k (haplotypes sorted by their
+ *     reversed prefixes over loci [0, k)) and divergence array d_k (where the
+ *     match between a_k[i - 1] and a_k[i] begins) for 0 <= k <= n_locus,
+ *     replayed from the checkpoint before k; divergence may be NULL. 0/-1.
+ *   - Rfmalloc_pbwt_long_matches: every match of >= min_length loci between
+ *     two panel haplotypes; emit(user, a, b, start, end) with a < b.
+ *   - Rfmalloc_pbwt_query: the set-maximal matches of each haplotype (column)
+ *     of `queries`, a haplotype store over the same loci, against the panel
+ *     `haplotypes` the index was built from; emit(user, query, haplotype,
+ *     start, end).
+ *   The two sweeps confine matches to loci [from, to), call emit on the
+ *   calling thread in order of end, stop when it returns non-zero, and return
+ *   0, 1 if stopped, or -1 on bad input. They split each locus over
+ *   fmalloc_threads() and never call Rf_error.
+ */
+typedef int (*Rfmalloc_pbwt_emit_fun)(void *user, R_xlen_t a, R_xlen_t b,
+                                      R_xlen_t start, R_xlen_t end);
+typedef SEXP (*Rfmalloc_pbwt_build_fun)(SEXP runtime, SEXP haplotypes,
+                                        R_xlen_t interval);
+typedef int (*Rfmalloc_pbwt_arrays_fun)(SEXP pbwt, R_xlen_t k, int32_t *prefix,
+                                        int32_t *divergence);
+typedef int (*Rfmalloc_pbwt_long_matches_fun)(SEXP pbwt, R_xlen_t min_length,
+                                              R_xlen_t from, R_xlen_t to,
+                                              Rfmalloc_pbwt_emit_fun emit,
+                                              void *user);
+typedef int (*Rfmalloc_pbwt_query_fun)(SEXP pbwt, SEXP haplotypes, SEXP queries,
+                                       R_xlen_t min_length, R_xlen_t from,
+                                       R_xlen_t to, Rfmalloc_pbwt_emit_fun emit,
+                                       void *user);
+
+/*
+ * Li and Stephens copying model over a haplotype store (li_stephens()). Each
+ * target (a 0-based haplotype) copies from all the other haplotypes: rho[l]
+ * (n_rho 1 or n_locus - 1) is the probability of switching donor between loci
+ * l and l + 1, mu[l] (n_mu 1 or n_locus) that the target differs from its
+ * donor at l. The posterior copying probabilities at each requested locus
+ * (0-based, strictly ascending) are passed to emit(user, locus, post, ld) on
+ * the calling thread, in descending order of locus, with post[t * ld + j] for
+ * target t and donor j; a non-zero return stops the sweep. Forward tables
+ * are checkpointed every `checkpoint` loci (0: automatic) in a scratch vector
+ * of `runtime`, freed before returning. Returns 0, 1 if stopped, or -1 on bad
+ * input; calls Rf_error only if the runtime cannot hold the tables, before
+ * the sweep starts. Targets are split over fmalloc_threads().
+ */
+typedef int (*Rfmalloc_li_stephens_emit_fun)(void *user, R_xlen_t locus,
+                                             const double *post, size_t ld);
+typedef int (*Rfmalloc_li_stephens_fun)(
+    SEXP runtime, SEXP haplotypes, const double *rho, R_xlen_t n_rho,
+    const double *mu, R_xlen_t n_mu, const int32_t *targets, R_xlen_t n_target,
+    const R_xlen_t *loci, R_xlen_t n_loci, R_xlen_t checkpoint,
+    Rfmalloc_li_stephens_emit_fun emit, void *user);
+
 /* Borrow bytes already owned by another mapped container. `owner` remains
  * reachable for the lifetime of the returned external pointer; `runtime` is
  * where Rfmalloc allocates decoded results. The view is read-only and does not
@@ -165,16 +361,42 @@ typedef int (*Rfmalloc_storage_advise_fun)(SEXP object, size_t offset,
  * RfmallocStatgen's statgen_snp_cor(); it is a typed accessor sibling of the
  * tensor codec (like the haplotype store), not a decode-to-f64 matmul codec.
  * Consumers (LDpred2) read one column's contiguous neighbour run at a time.
+ * A store is either a full band or a thresholded sparse store (see
+ * Rfmalloc_ld_sparsify); everything below except col_raw reads both.
  *   - Rfmalloc_ld_ncol: number of variants (columns == rows), or -1.
  *   - Rfmalloc_ld_bits: quantization width, 8 or 16, or -1.
  *   - Rfmalloc_ld_pair: r[i, j] (0-based), 0.0 outside the band.
  *   - Rfmalloc_ld_col: decode column j's band into out (>= *len doubles),
  *     setting *lo (band start row) and *len (band length); returns 0/-1.
+ *     A sparse column decodes to the rows its entries span, 0 where dropped.
  *   - Rfmalloc_ld_col_raw: zero-copy pointer to column j's raw int8/int16 codes
- *     (decode a code c as c / (bits==16 ? 32767 : 127)); returns 0/-1.
+ *     (decode a code c as c / (bits==16 ? 32767 : 127)); returns 0/-1, and -1
+ *     for a sparse store.
  *   - Rfmalloc_ld_build: build an ld store from computed per-column bands (lo,
  *     len 0-based, rvals the column-major concatenation of band correlations);
  *     returns the ALTREP raw payload SEXP - PROTECT it immediately.
+ *   - Rfmalloc_ld_writer_*: build one without holding the band in RAM. open
+ *     takes the same lo/len (a symmetric band: lo and lo + len - 1
+ *     non-decreasing, column k reaching row j iff column j reaches row k) and
+ *     returns NULL if they are not; append(j, r) takes columns in order, r
+ *     being rows lo[j]..j with the diagonal last, quantizes them into the
+ *     mapped store and mirrors them into the earlier columns; finish returns
+ *     the sealed store (PROTECT it) or R_NilValue while columns are missing;
+ *     abort discards it. append/finish/abort never call Rf_error.
+ *   - Rfmalloc_ld_data: fill a Rfmalloc_ld_view of the store (0/-1). The view
+ *     points into the store, which must stay reachable while it is used.
+ *   - Rfmalloc_ld_matvec / Rfmalloc_ld_matmat: out = C x for one vector or
+ *     for k column-major right-hand sides (m x k, leading dimension m). They
+ *     read the codes directly, widen them to double with the scale applied
+ *     once per output, and split columns over fmalloc_threads(). A band
+ *     flagged symmetric is read as rows, one dot product per output, and
+ *     matmat reuses each widened band across the k vectors; any other store
+ *     scatters x[j] C[:, j] per column. Returns 0, non-zero on error.
+ *   - Rfmalloc_ld_axpy_col: out += a * C[:, j] over column j's band only.
+ *   - Rfmalloc_ld_sparsify: a new sparse store keeping the off-diagonal
+ *     entries with |r| >= threshold, at the same bits with a per-column scale;
+ *     the diagonal is implicit. Returns the payload SEXP (PROTECT it).
+ *   None of the view kernels call Rf_error.
  */
 typedef R_xlen_t (*Rfmalloc_ld_ncol_fun)(SEXP store);
 typedef int (*Rfmalloc_ld_bits_fun)(SEXP store);
@@ -186,6 +408,41 @@ typedef int (*Rfmalloc_ld_col_raw_fun)(SEXP store, R_xlen_t j, R_xlen_t *lo,
 typedef SEXP (*Rfmalloc_ld_build_fun)(SEXP runtime, R_xlen_t n_variants, int bits,
                                       int window, const R_xlen_t *lo,
                                       const R_xlen_t *len, const double *rvals);
+struct Rfmalloc_ld_writer;
+/* cum[j] .. cum[j + 1] index column j's codes in values (int8 when bits == 8,
+ * int16 when 16; decode c as c / (bits == 16 ? 32767 : 127)), covering rows
+ * lo[j] onward. When sparse is set, lo is NULL, column j's codes decode as
+ * c * step[j] and exclude the diagonal (1), and their rows are the LEB128
+ * varints at rows + row_off[j]: the first a zigzag offset from j, each next
+ * the gap minus one. symmetric is set for a band store whose codes equal
+ * their mirrors, so that row j of C is column j. */
+struct Rfmalloc_ld_view {
+    const uint64_t *cum;
+    const int64_t *lo;
+    const void *values;
+    R_xlen_t n_variant;
+    int bits;
+    int sparse;
+    const uint64_t *row_off;
+    const uint8_t *rows;
+    const double *step;
+    int symmetric;
+};
+typedef int (*Rfmalloc_ld_data_fun)(SEXP store, struct Rfmalloc_ld_view *view);
+typedef int (*Rfmalloc_ld_matvec_fun)(const struct Rfmalloc_ld_view *view,
+                                      const double *x, double *out);
+typedef int (*Rfmalloc_ld_matmat_fun)(const struct Rfmalloc_ld_view *view,
+                                      const double *x, R_xlen_t k, double *out);
+typedef int (*Rfmalloc_ld_axpy_col_fun)(const struct Rfmalloc_ld_view *view,
+                                        R_xlen_t j, double a, double *out);
+typedef SEXP (*Rfmalloc_ld_sparsify_fun)(SEXP runtime, SEXP store, double threshold);
+typedef struct Rfmalloc_ld_writer *(*Rfmalloc_ld_writer_open_fun)(
+    SEXP runtime, R_xlen_t n_variants, int bits, int window,
+    const R_xlen_t *lo, const R_xlen_t *len);
+typedef int (*Rfmalloc_ld_writer_append_fun)(struct Rfmalloc_ld_writer *w,
+                                             R_xlen_t j, const double *r);
+typedef SEXP (*Rfmalloc_ld_writer_finish_fun)(struct Rfmalloc_ld_writer *w);
+typedef void (*Rfmalloc_ld_writer_abort_fun)(struct Rfmalloc_ld_writer *w);
 
 static inline Rfmalloc_default_runtime_fun Rfmalloc_default_runtime_ptr(void)
 {
@@ -387,6 +644,53 @@ static inline int Rfmalloc_register_matmul_backend_ex(const char *name,
     return Rfmalloc_register_matmul_backend_ex_ptr()(name, fn, typed_fn);
 }
 
+static inline Rfmalloc_register_tensor_codec_ex_fun Rfmalloc_register_tensor_codec_ex_ptr(void)
+{
+    return (Rfmalloc_register_tensor_codec_ex_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_register_tensor_codec_ex");
+}
+
+static inline int Rfmalloc_register_tensor_codec_ex(const char *name,
+                                                    unsigned int items_per_block,
+                                                    unsigned int bytes_per_block,
+                                                    Rfmalloc_tensor_decode_fn decode,
+                                                    Rfmalloc_tensor_product_fn product)
+{
+    return Rfmalloc_register_tensor_codec_ex_ptr()(name, items_per_block, bytes_per_block,
+                                                   decode, product);
+}
+
+static inline Rfmalloc_register_tensor_codec_extent_fun Rfmalloc_register_tensor_codec_extent_ptr(void)
+{
+    return (Rfmalloc_register_tensor_codec_extent_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_register_tensor_codec_extent");
+}
+
+static inline int Rfmalloc_register_tensor_codec_extent(const char *name,
+                                                        Rfmalloc_tensor_extent_fn extent)
+{
+    return Rfmalloc_register_tensor_codec_extent_ptr()(name, extent);
+}
+
+static inline Rfmalloc_register_tensor_codec_error_fun Rfmalloc_register_tensor_codec_error_ptr(void)
+{
+    return (Rfmalloc_register_tensor_codec_error_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_register_tensor_codec_error");
+}
+
+static inline int Rfmalloc_register_tensor_codec_error(const char *name,
+                                                       Rfmalloc_tensor_error_fn error)
+{
+    return Rfmalloc_register_tensor_codec_error_ptr()(name, error);
+}
+
+static inline Rfmalloc_unregister_tensor_codec_fun Rfmalloc_unregister_tensor_codec_ptr(void)
+{
+    return (Rfmalloc_unregister_tensor_codec_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_unregister_tensor_codec");
+}
+
+static inline int Rfmalloc_unregister_tensor_codec(const char *name)
+{
+    return Rfmalloc_unregister_tensor_codec_ptr()(name);
+}
+
 static inline Rfmalloc_tensor_decode_range_fun Rfmalloc_tensor_decode_ptr(void)
 {
     return (Rfmalloc_tensor_decode_range_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_tensor_decode");
@@ -422,6 +726,24 @@ static inline Rfmalloc_buffer_abort_fun Rfmalloc_buffer_abort_ptr(void)
         R_GetCCallable("Rfmalloc", "Rfmalloc_buffer_abort");
 }
 
+static inline Rfmalloc_buffer_writer_open_fun Rfmalloc_buffer_writer_open_ptr(void)
+{
+    return (Rfmalloc_buffer_writer_open_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_buffer_writer_open");
+}
+
+static inline Rfmalloc_buffer_writer_write_fun Rfmalloc_buffer_writer_write_ptr(void)
+{
+    return (Rfmalloc_buffer_writer_write_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_buffer_writer_write");
+}
+
+static inline Rfmalloc_buffer_writer_close_fun Rfmalloc_buffer_writer_close_ptr(void)
+{
+    return (Rfmalloc_buffer_writer_close_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_buffer_writer_close");
+}
+
 static inline Rfmalloc_haplotypes_data_fun Rfmalloc_haplotypes_data_ptr(void)
 {
     return (Rfmalloc_haplotypes_data_fun)
@@ -434,6 +756,65 @@ static inline int Rfmalloc_haplotypes_data(
     return Rfmalloc_haplotypes_data_ptr()(store, view);
 }
 
+static inline int Rfmalloc_hap_rows(SEXP store, R_xlen_t first, R_xlen_t n,
+                                    uint8_t *dst, size_t dst_stride)
+{
+    return ((Rfmalloc_hap_rows_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_hap_rows"))(
+        store, first, n, dst, dst_stride);
+}
+
+static inline int Rfmalloc_hap_allele_counts(SEXP store, R_xlen_t first,
+                                             R_xlen_t n, int margin,
+                                             R_xlen_t *counts)
+{
+    return ((Rfmalloc_hap_allele_counts_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_hap_allele_counts"))(
+        store, first, n, margin, counts);
+}
+
+static inline SEXP Rfmalloc_pbwt_build(SEXP runtime, SEXP haplotypes,
+                                       R_xlen_t interval)
+{
+    return ((Rfmalloc_pbwt_build_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_pbwt_build"))(
+        runtime, haplotypes, interval);
+}
+
+static inline int Rfmalloc_pbwt_arrays(SEXP pbwt, R_xlen_t k, int32_t *prefix,
+                                       int32_t *divergence)
+{
+    return ((Rfmalloc_pbwt_arrays_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_pbwt_arrays"))(
+        pbwt, k, prefix, divergence);
+}
+
+static inline int Rfmalloc_pbwt_long_matches(SEXP pbwt, R_xlen_t min_length,
+                                             R_xlen_t from, R_xlen_t to,
+                                             Rfmalloc_pbwt_emit_fun emit,
+                                             void *user)
+{
+    return ((Rfmalloc_pbwt_long_matches_fun) R_GetCCallable(
+        "Rfmalloc", "Rfmalloc_pbwt_long_matches"))(pbwt, min_length, from, to,
+                                                   emit, user);
+}
+
+static inline int Rfmalloc_pbwt_query(SEXP pbwt, SEXP haplotypes, SEXP queries,
+                                      R_xlen_t min_length, R_xlen_t from,
+                                      R_xlen_t to, Rfmalloc_pbwt_emit_fun emit,
+                                      void *user)
+{
+    return ((Rfmalloc_pbwt_query_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_pbwt_query"))(
+        pbwt, haplotypes, queries, min_length, from, to, emit, user);
+}
+
+static inline int Rfmalloc_li_stephens(
+    SEXP runtime, SEXP haplotypes, const double *rho, R_xlen_t n_rho,
+    const double *mu, R_xlen_t n_mu, const int32_t *targets, R_xlen_t n_target,
+    const R_xlen_t *loci, R_xlen_t n_loci, R_xlen_t checkpoint,
+    Rfmalloc_li_stephens_emit_fun emit, void *user)
+{
+    return ((Rfmalloc_li_stephens_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_li_stephens"))(
+        runtime, haplotypes, rho, n_rho, mu, n_mu, targets, n_target, loci,
+        n_loci, checkpoint, emit, user);
+}
+
 static inline Rfmalloc_storage_view_fun Rfmalloc_storage_view_ptr(void)
 {
     return (Rfmalloc_storage_view_fun)
@@ -505,6 +886,61 @@ static inline SEXP Rfmalloc_ld_build(SEXP runtime, R_xlen_t n_variants, int bits
         runtime, n_variants, bits, window, lo, len, rvals);
 }
 
+static inline Rfmalloc_ld_writer_open_fun Rfmalloc_ld_writer_open_ptr(void)
+{
+    return (Rfmalloc_ld_writer_open_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_ld_writer_open");
+}
+
+static inline Rfmalloc_ld_writer_append_fun Rfmalloc_ld_writer_append_ptr(void)
+{
+    return (Rfmalloc_ld_writer_append_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_ld_writer_append");
+}
+
+static inline Rfmalloc_ld_writer_finish_fun Rfmalloc_ld_writer_finish_ptr(void)
+{
+    return (Rfmalloc_ld_writer_finish_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_ld_writer_finish");
+}
+
+static inline Rfmalloc_ld_writer_abort_fun Rfmalloc_ld_writer_abort_ptr(void)
+{
+    return (Rfmalloc_ld_writer_abort_fun)
+        R_GetCCallable("Rfmalloc", "Rfmalloc_ld_writer_abort");
+}
+
+static inline Rfmalloc_ld_data_fun Rfmalloc_ld_data_ptr(void)
+{
+    return (Rfmalloc_ld_data_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_ld_data");
+}
+
+static inline int Rfmalloc_ld_data(SEXP store, struct Rfmalloc_ld_view *view)
+{
+    return Rfmalloc_ld_data_ptr()(store, view);
+}
+
+static inline Rfmalloc_ld_matvec_fun Rfmalloc_ld_matvec_ptr(void)
+{
+    return (Rfmalloc_ld_matvec_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_ld_matvec");
+}
+
+static inline Rfmalloc_ld_matmat_fun Rfmalloc_ld_matmat_ptr(void)
+{
+    return (Rfmalloc_ld_matmat_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_ld_matmat");
+}
+
+static inline Rfmalloc_ld_axpy_col_fun Rfmalloc_ld_axpy_col_ptr(void)
+{
+    return (Rfmalloc_ld_axpy_col_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_ld_axpy_col");
+}
+
+static inline SEXP Rfmalloc_ld_sparsify(SEXP runtime, SEXP store, double threshold)
+{
+    return ((Rfmalloc_ld_sparsify_fun) R_GetCCallable("Rfmalloc", "Rfmalloc_ld_sparsify"))(
+        runtime, store, threshold);
+}
+
 #ifdef __cplusplus
 }
 #endif
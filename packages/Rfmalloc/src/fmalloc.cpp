@@ -6,6 +6,7 @@
 #include "fmalloc_backend.inc"
 #include "fmalloc_ops.inc"
 #include "fmalloc_ooc.inc"
+#include "fmalloc_parallel.inc"
 #include "fmalloc_span.inc"
 #include "fmalloc_tensor.inc"
 #include "fmalloc_alp.inc"
@@ -13,6 +14,8 @@
 #include "fmalloc_bed.inc"
 #include "fmalloc_dosage.inc"
 #include "fmalloc_hap.inc"
+#include "fmalloc_pbwt.inc"
+#include "fmalloc_ls.inc"
 #include "fmalloc_buffer.inc"
 #include "fmalloc_ld.inc"
 #include "fmalloc_insitu.inc"
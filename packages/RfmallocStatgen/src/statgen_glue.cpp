@@ -134,12 +134,16 @@ extern "C" SEXP C_statgen_decode_panel(SEXP tensor, SEXP ns, SEXP starts,
 // statgen_snp_cor: stream a genotype tensor one variant-column at a time via
 // Rfmalloc_tensor_decode, compute the windowed Pearson correlation between
 // nearby variants (mean-impute + centre + unit-L2-normalize each column, then
-// r = dot of the two unit columns), and pack the banded result into an
-// Rfmalloc "ld" store (Rfmalloc_ld_build). The dense p x p is never formed and
-// only a sliding window of unit columns (bounded by the window width, not m) is
-// held resident. Storage-agnostic result: the caller reads it with
-// ld_col()/ld_pair() or hands it to LDpred2.
+// r = dot of the two unit columns), and stream each column's band into an
+// Rfmalloc "ld" store through its writer (Rfmalloc_ld_writer_*), which
+// quantizes it straight into the mapped payload. Neither the dense p x p nor
+// the band is ever held in RAM: only a sliding window of unit columns (bounded
+// by the window width, not m) and the O(m) band bounds are resident.
+// Storage-agnostic result: the caller reads it with ld_col()/ld_pair() or
+// hands it to LDpred2.
 // ---------------------------------------------------------------------------
+static void snp_cor_interrupt_check(void*) { R_CheckUserInterrupt(); }
+
 extern "C" SEXP C_statgen_snp_cor(SEXP tensor, SEXP ns, SEXP ms, SEXP sizes,
                                   SEXP thr_r2s, SEXP infos_pos, SEXP bitss) {
   const R_xlen_t n = (R_xlen_t)Rf_asInteger(ns);
@@ -158,39 +162,44 @@ extern "C" SEXP C_statgen_snp_cor(SEXP tensor, SEXP ns, SEXP ms, SEXP sizes,
   if (has_pos && (R_xlen_t)Rf_xlength(infos_pos) != m)
     Rf_error("infos_pos must have length equal to the number of variants");
 
-  // Per-column contiguous band [lo_j, hi_j] (0-based), the cumulative offset
-  // table, and the total number of stored entries.
-  std::vector<R_xlen_t> lo((size_t)m), hi((size_t)m), len((size_t)m);
-  std::vector<R_xlen_t> cum((size_t)m + 1);
+  // Per-column contiguous band [lo_j, hi_j] (0-based). The lower bound comes
+  // from the window rule; the upper bound is then derived from it (hi_j is the
+  // last column whose band starts at or before j), so the band is symmetric
+  // by construction, as the writer requires, whatever rounding the position
+  // comparisons do.
+  std::vector<R_xlen_t> lo((size_t)m), len((size_t)m);
+  R_xlen_t max_lower = 0;
   {
-    R_xlen_t a = 0, b = 0;  // two pointers for the position-based window
-    R_xlen_t acc = 0;
+    R_xlen_t a = 0;  // two pointers for the position-based window
     for (R_xlen_t j = 0; j < m; j++) {
-      R_xlen_t loj, hij;
       if (has_pos) {
-        if (a > j) a = j;
         while (a < j && pos[a] < pos[j] - W) a++;
-        if (b < j) b = j;
-        while (b + 1 < m && pos[b + 1] <= pos[j] + W) b++;
-        loj = a;
-        hij = b;
+        lo[(size_t)j] = a;
       } else {
-        loj = (j > size_idx) ? (j - size_idx) : 0;
-        hij = (j + size_idx < m - 1) ? (j + size_idx) : (m - 1);
+        lo[(size_t)j] = (j > size_idx) ? (j - size_idx) : 0;
       }
-      lo[(size_t)j] = loj;
-      hi[(size_t)j] = hij;
-      len[(size_t)j] = hij - loj + 1;
-      cum[(size_t)j] = acc;
-      acc += len[(size_t)j];
+      if (j - lo[(size_t)j] > max_lower) max_lower = j - lo[(size_t)j];
+    }
+    R_xlen_t b = 0;
+    for (R_xlen_t j = 0; j < m; j++) {
+      if (b < j) b = j;
+      while (b + 1 < m && lo[(size_t)(b + 1)] <= j) b++;
+      len[(size_t)j] = b - lo[(size_t)j] + 1;
     }
-    cum[(size_t)m] = acc;
   }
-  const R_xlen_t nnz = cum[(size_t)m];
 
-  std::vector<double> rvals((size_t)nnz, 0.0);
+  SEXP runtime = Rfmalloc_runtime_of_vector(tensor);
+  const int window = has_pos ? (int)W : (int)size_idx;
+  Rfmalloc_ld_writer_append_fun ld_append = Rfmalloc_ld_writer_append_ptr();
+  Rfmalloc_ld_writer_finish_fun ld_finish = Rfmalloc_ld_writer_finish_ptr();
+  Rfmalloc_ld_writer_abort_fun ld_abort = Rfmalloc_ld_writer_abort_ptr();
+  Rfmalloc_ld_writer* writer = Rfmalloc_ld_writer_open_ptr()(
+      runtime, m, bits, window, lo.data(), len.data());
+  if (!writer) Rf_error("statgen_snp_cor: failed to open the ld store writer");
+
   std::vector<std::vector<double> > cols((size_t)m);  // sliding unit columns
   std::vector<double> buf((size_t)n);
+  std::vector<double> band((size_t)max_lower + 1);  // rows lo_j..j of column j
   R_xlen_t cleared = 0;  // columns < cleared have been evicted
 
   for (R_xlen_t j = 0; j < m; j++) {
@@ -201,6 +210,7 @@ extern "C" SEXP C_statgen_snp_cor(SEXP tensor, SEXP ns, SEXP ms, SEXP sizes,
     }
 
     if (Rfmalloc_tensor_decode(tensor, j * n, n, buf.data()) != 0) {
+      ld_abort(writer);
       Rf_error("statgen_snp_cor: failed to decode variant column %lld",
                (long long)j);
     }
@@ -227,106 +237,106 @@ extern "C" SEXP C_statgen_snp_cor(SEXP tensor, SEXP ns, SEXP ms, SEXP sizes,
     }  // else monomorphic: unit column stays 0, so all its off-diagonals are 0
     cols[(size_t)j].swap(u);
 
-    // diagonal r = 1
-    rvals[(size_t)(cum[(size_t)j] + (j - lo[(size_t)j]))] = 1.0;
-
-    // correlations with the already-decoded in-window neighbours below j; store
-    // both (j,k) and (k,j) since the full symmetric band is kept.
+    // correlations with the already-decoded in-window neighbours below j; the
+    // writer mirrors each into (row j, col k), keeping the full symmetric band.
+    const R_xlen_t loj = lo[(size_t)j];
     const double* uj = cols[(size_t)j].data();
-    for (R_xlen_t k = lo[(size_t)j]; k < j; k++) {
-      const std::vector<double>& ck = cols[(size_t)k];
-      if (ck.empty()) continue;  // defensive; k >= lo[j] means not yet evicted
-      const double* uk = ck.data();
+    for (R_xlen_t k = loj; k < j; k++) {
+      const double* uk = cols[(size_t)k].data();
       double r = 0.0;
       for (R_xlen_t i = 0; i < n; i++) r += uj[(size_t)i] * uk[(size_t)i];
       if (thr_r2 > 0.0 && r * r < thr_r2) r = 0.0;
-      rvals[(size_t)(cum[(size_t)k] + (j - lo[(size_t)k]))] = r;  // (row j, col k)
-      rvals[(size_t)(cum[(size_t)j] + (k - lo[(size_t)j]))] = r;  // (row k, col j)
+      band[(size_t)(k - loj)] = r;
+    }
+    band[(size_t)(j - loj)] = 1.0;  // diagonal
+    if (ld_append(writer, j, band.data()) != 0) {
+      ld_abort(writer);
+      Rf_error("statgen_snp_cor: the ld store rejected variant column %lld",
+               (long long)j);
     }
 
-    if ((j & 0x3FF) == 0) R_CheckUserInterrupt();
+    if ((j & 0x3FF) == 0 &&
+        R_ToplevelExec(snp_cor_interrupt_check, nullptr) == FALSE) {
+      ld_abort(writer);
+      Rf_error("statgen_snp_cor interrupted");
+    }
   }
 
-  SEXP runtime = Rfmalloc_runtime_of_vector(tensor);
-  const int window = has_pos ? (int)W : (int)size_idx;
-  SEXP payload = PROTECT(Rfmalloc_ld_build(runtime, m, bits, window,
-                                           lo.data(), len.data(), rvals.data()));
+  SEXP payload = PROTECT(ld_finish(writer));
+  if (payload == R_NilValue) {
+    ld_abort(writer);
+    UNPROTECT(1);
+    Rf_error("statgen_snp_cor: failed to finish the ld store");
+  }
   UNPROTECT(1);
   return payload;
 }
 
 // ---------------------------------------------------------------------------
 // LDpred2 (Prive, Arbel & Vilhjalmsson 2020, Bioinformatics), reimplemented
-// clean-room over the banded fmalloc_ld store. All three variants read the LD
-// matrix one column's contiguous neighbour run at a time via the fmalloc_ld
-// C-callables (Rfmalloc_ld_col_raw): never a dense p x p, never the genotypes.
+// clean-room over the fmalloc_ld store, band or thresholded sparse. All three
+// variants touch the LD matrix only through Rfmalloc's kernels
+// (Rfmalloc_ld_matvec, Rfmalloc_ld_axpy_col), which work on the quantized codes
+// in place: never a dense p x p, never the genotypes.
 // ---------------------------------------------------------------------------
 
 namespace {
 
-// A read-once, zero-copy view of an ld store: per-column band start (lo), band
-// length (len) and a pointer to the raw int8/int16 codes (into the mmap'd
-// payload). Decode a code c as c / (bits == 16 ? 32767 : 127).
+// A zero-copy view of an ld store (Rfmalloc_ld_view: the offset table and the
+// raw int8/int16 codes in the mmap'd payload) plus Rfmalloc's native band
+// kernels, resolved once so the Gibbs sweeps call them directly.
 struct LdView {
   R_xlen_t m = 0;
   int bits = 8;
-  std::vector<R_xlen_t> lo, len;
-  std::vector<const void*> vals;
+  Rfmalloc_ld_view view;
+  Rfmalloc_ld_matvec_fun matvec = nullptr;
+  Rfmalloc_ld_axpy_col_fun axpy = nullptr;
 };
 
 void ld_load(SEXP corr, LdView* v) {
-  const R_xlen_t m = Rfmalloc_ld_ncol(corr);
-  if (m < 0) Rf_error("corr must be an fmalloc_ld store");
-  v->m = m;
-  v->bits = Rfmalloc_ld_bits(corr);
-  v->lo.resize((size_t)m);
-  v->len.resize((size_t)m);
-  v->vals.resize((size_t)m);
-  for (R_xlen_t j = 0; j < m; j++) {
-    if (Rfmalloc_ld_col_raw(corr, j, &v->lo[(size_t)j], &v->len[(size_t)j],
-                            &v->vals[(size_t)j]) != 0) {
-      Rf_error("failed to read ld column %lld", (long long)j);
-    }
+  if (Rfmalloc_ld_data(corr, &v->view) != 0) {
+    Rf_error("corr must be an fmalloc_ld store");
   }
+  v->m = v->view.n_variant;
+  v->bits = v->view.bits;
+  v->matvec = Rfmalloc_ld_matvec_ptr();
+  v->axpy = Rfmalloc_ld_axpy_col_ptr();
 }
 
 // out += C[:, j] * a  (the full symmetric band of column j, diagonal included).
 inline void ld_axpy_col(const LdView& v, R_xlen_t j, double a, double* out) {
-  const R_xlen_t l = v.lo[(size_t)j];
-  const R_xlen_t n = v.len[(size_t)j];
-  if (v.bits == 16) {
-    const int16_t* p = static_cast<const int16_t*>(v.vals[(size_t)j]);
-    for (R_xlen_t t = 0; t < n; t++) out[l + t] += (double)p[t] / 32767.0 * a;
-  } else {
-    const int8_t* p = static_cast<const int8_t*>(v.vals[(size_t)j]);
-    for (R_xlen_t t = 0; t < n; t++) out[l + t] += (double)p[t] / 127.0 * a;
-  }
+  v.axpy(&v.view, j, a, out);
 }
 
-// out = C x  (banded matrix-vector product).
+// out = C x  (banded matrix-vector product, split over Rfmalloc's threads).
+// A single right-hand side needs no scratch, so this cannot fail on a view
+// ld_load() accepted.
 void ld_matvec(const LdView& v, const double* x, double* out) {
-  std::fill(out, out + v.m, 0.0);
-  for (R_xlen_t j = 0; j < v.m; j++) {
-    const double xj = x[(size_t)j];
-    if (xj != 0.0) ld_axpy_col(v, j, xj, out);
-  }
+  v.matvec(&v.view, x, out);
 }
 
 // Mean LD score = mean over columns of sum_k C[k, j]^2 (diagonal 1 included).
+// A sparse store keeps the diagonal implicit and scales codes per column.
 double ld_mean_ldscore(const LdView& v) {
   if (v.m == 0) return 1.0;
+  const uint64_t nnz = v.view.cum[v.m];
   double total = 0.0;
-  for (R_xlen_t j = 0; j < v.m; j++) {
-    const R_xlen_t n = v.len[(size_t)j];
-    double s = 0.0;
-    if (v.bits == 16) {
-      const int16_t* p = static_cast<const int16_t*>(v.vals[(size_t)j]);
-      for (R_xlen_t t = 0; t < n; t++) { double r = (double)p[t] / 32767.0; s += r * r; }
-    } else {
-      const int8_t* p = static_cast<const int8_t*>(v.vals[(size_t)j]);
-      for (R_xlen_t t = 0; t < n; t++) { double r = (double)p[t] / 127.0; s += r * r; }
+  if (v.view.sparse) {
+    for (R_xlen_t j = 0; j < v.m; j++) {
+      double s = 0.0;
+      for (uint64_t t = v.view.cum[j]; t < v.view.cum[j + 1]; t++) {
+        const double c = v.bits == 16 ? static_cast<const int16_t*>(v.view.values)[t]
+                                      : static_cast<const int8_t*>(v.view.values)[t];
+        s += c * c;
+      }
+      total += 1.0 + s * v.view.step[j] * v.view.step[j];
     }
-    total += s;
+  } else if (v.bits == 16) {
+    const int16_t* p = static_cast<const int16_t*>(v.view.values);
+    for (uint64_t t = 0; t < nnz; t++) { double r = (double)p[t] / 32767.0; total += r * r; }
+  } else {
+    const int8_t* p = static_cast<const int8_t*>(v.view.values);
+    for (uint64_t t = 0; t < nnz; t++) { double r = (double)p[t] / 127.0; total += r * r; }
   }
   return total / (double)v.m;
 }
@@ -154,6 +154,9 @@ typedef int (*Rpgen_read_bed_hardcalls_fun)(const char *bed_path,
  * src/rpgen_import.cpp's top comment). Read the resulting .pgen with
  * Rpgen_open_info()/Rpgen_read_hardcalls()/Rpgen_read_dosages() above, same
  * as any other .pgen.
+ *
+ * Runs the importer on one thread. R's rpgen_import_vcf(threads = ) is the
+ * multithreaded path; this entry point keeps its original signature.
  */
 typedef int (*Rpgen_import_vcf_fun)(const char *vcf_path,
                                     const char *out_pgen_path, char *errbuf,
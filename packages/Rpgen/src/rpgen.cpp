@@ -19,6 +19,21 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include <R.h>
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
@@ -40,6 +55,8 @@
 #  undef TRUE
 #endif
 
+#include "rpgen_qc.h"
+
 namespace {
 
 // Open fname just far enough to read PgenFileInfo's header counts, then
@@ -197,7 +214,7 @@ static const int32_t kGenoRInt32Quads[1024] ALIGNV16 =
 static const double kGenoRDoublePairs[32] ALIGNV16 =
     PAIR_TABLE16(0.0, 1.0, 2.0, NA_REAL);
 
-// A fully-opened, all-samples reader: PgfiInitPhase1/2 + PgrInit (as
+// A fully-opened reader: PgfiInitPhase1/2 + PgrInit (as
 // rpgen_open_info() above) plus the extra buffers plink2::PgrGet()/PgrGetD()
 // themselves need - a sample_include bitvec (and its interleaved twin), its
 // cumulative popcounts, a genovec scratch buffer, and (when with_dosage) a
@@ -207,8 +224,9 @@ static const double kGenoRDoublePairs[32] ALIGNV16 =
 // no raregeno/difflist buffers (sparse reads), no multiallelic patch01/10
 // buffers or multiallelic patch buffers.
 //
-// sample_include is always filled to mark every sample present (there is no
-// sample-subsetting API yet), via the same SetBit()/FillInterleavedMaskVec()/
+// sample_include marks every sample present unless the caller selects a
+// subset, which pgenlib then applies while decoding. Either way it is filled
+// via the same SetBit()/FillInterleavedMaskVec()/
 // FillCumulativePopcounts() sequence pgenlibr's SetSampleSubsetInternal()
 // uses for an explicit sample_subset - deliberately not the "leave these
 // buffers uninitialized, PgrGet() special-cases sample_ct == raw_sample_ct"
@@ -233,8 +251,14 @@ struct RpgenFullReader {
   uintptr_t *phasepresent;    // nullptr unless opened with_phase
   uintptr_t *phaseinfo;       // nullptr unless opened with_phase
 
-  uint32_t n_sample;
+  uint32_t n_sample;   // selected samples: the width of every decoded record
   uint32_t n_variant;
+
+  // PgfiInitPhase2() output, kept so rpgen_full_reader_clone() can size
+  // another PgenReader over the same info.
+  uint32_t max_vrec_width;
+  uintptr_t pgr_alloc_cacheline_ct;
+  bool owns_info;  // false for a clone: info's arrays belong to its source
 };
 
 void rpgen_full_reader_preinit(RpgenFullReader *r) {
@@ -254,6 +278,9 @@ void rpgen_full_reader_preinit(RpgenFullReader *r) {
   r->phaseinfo = nullptr;
   r->n_sample = 0;
   r->n_variant = 0;
+  r->max_vrec_width = 0;
+  r->pgr_alloc_cacheline_ct = 0;
+  r->owns_info = true;
 }
 
 // Releases every resource rpgen_full_reader_open() may have acquired, safe to
@@ -270,6 +297,9 @@ void rpgen_full_reader_release(RpgenFullReader *r) {
     plink2::aligned_free(r->pgr_alloc);
   }
 
+  if (!r->owns_info) {
+    return;
+  }
   cleanup_reterr = plink2::kPglRetSuccess;
   plink2::CleanupPgfi(&r->info, &cleanup_reterr);
   if (r->info.vrtypes) {
@@ -280,6 +310,124 @@ void rpgen_full_reader_release(RpgenFullReader *r) {
   plink2::CondReleaseRefcountedWptr(&r->allele_idx_offsetsp);
 }
 
+// Gives r, whose info has been through PgfiInitPhase2(), a PgenReader over
+// fname plus the read buffers rpgen_full_reader_open() documents. Returns 0,
+// or -1 with errbuf set; the caller releases r either way.
+static int rpgen_full_reader_attach(const char *fname, bool with_dosage,
+                                    bool with_phase, RpgenFullReader *r,
+                                    char *errbuf, size_t errbuf_len,
+                                    const uint32_t *sample_idx,
+                                    uint32_t sample_ct) {
+  // pgr_alloc holds two regions back to back: PgrInit()'s own internal
+  // working set (pgr_alloc_main_byte_ct, opaque to us) followed by our own
+  // sample-subset/genovec/dosage buffers, carved out below exactly the way
+  // pgenlibr's Load() carves the same buffers out of its own larger
+  // pgr_alloc (it additionally reserves raregeno/difflist/multiallelic-
+  // patch/phase/transpose regions we don't need here).
+  const uint32_t file_sample_ct = r->info.raw_sample_ct;
+  const uintptr_t pgr_alloc_main_byte_ct =
+      r->pgr_alloc_cacheline_ct * plink2::kCacheline;
+  const uintptr_t sample_subset_byte_ct =
+      plink2::DivUp(file_sample_ct, plink2::kBitsPerVec) *
+      plink2::kBytesPerVec;
+  const uintptr_t cumulative_popcounts_byte_ct =
+      plink2::DivUp(file_sample_ct,
+                     plink2::kBitsPerWord * plink2::kInt32PerVec) *
+      plink2::kBytesPerVec;
+  const uintptr_t genovec_byte_ct =
+      plink2::DivUp(file_sample_ct, plink2::kNypsPerVec) *
+      plink2::kBytesPerVec;
+  const uintptr_t dosage_present_byte_ct =
+      with_dosage ? sample_subset_byte_ct : 0;
+  const uintptr_t dosage_main_byte_ct =
+      with_dosage ? plink2::DivUp(file_sample_ct,
+                                   2 * plink2::kInt32PerVec) *
+                         plink2::kBytesPerVec
+                  : 0;
+  const uintptr_t phase_byte_ct =
+      with_phase ? sample_subset_byte_ct : 0;
+  const uintptr_t extra_byte_ct =
+      2 * sample_subset_byte_ct + cumulative_popcounts_byte_ct +
+      genovec_byte_ct + dosage_present_byte_ct + dosage_main_byte_ct +
+      2 * phase_byte_ct;
+
+  if (plink2::cachealigned_malloc(pgr_alloc_main_byte_ct + extra_byte_ct,
+                                   &r->pgr_alloc)) {
+    snprintf(errbuf, errbuf_len, "out of memory (pgr_alloc)");
+    return -1;
+  }
+
+  const plink2::PglErr reterr =
+      plink2::PgrInit(fname, r->max_vrec_width, &r->info, &r->state,
+                       r->pgr_alloc);
+  if (reterr != plink2::kPglRetSuccess) {
+    snprintf(errbuf, errbuf_len, "PgrInit() error %d",
+             static_cast<int>(reterr));
+    return -1;
+  }
+
+  unsigned char *iter = &r->pgr_alloc[pgr_alloc_main_byte_ct];
+  r->subset_include_vec = reinterpret_cast<uintptr_t *>(iter);
+  iter += sample_subset_byte_ct;
+  r->subset_include_interleaved_vec = reinterpret_cast<uintptr_t *>(iter);
+  iter += sample_subset_byte_ct;
+#ifdef USE_AVX2
+  r->subset_include_interleaved_vec[-3] = 0;
+  r->subset_include_interleaved_vec[-2] = 0;
+#endif
+  r->subset_include_interleaved_vec[-1] = 0;
+  r->subset_cumulative_popcounts = reinterpret_cast<uint32_t *>(iter);
+  iter += cumulative_popcounts_byte_ct;
+  r->genovec = reinterpret_cast<uintptr_t *>(iter);
+  iter += genovec_byte_ct;
+  if (with_dosage) {
+    r->dosage_present = reinterpret_cast<uintptr_t *>(iter);
+    iter += dosage_present_byte_ct;
+    r->dosage_main = reinterpret_cast<uint16_t *>(iter);
+    iter += dosage_main_byte_ct;
+  }
+  if (with_phase) {
+    r->phasepresent = reinterpret_cast<uintptr_t *>(iter);
+    iter += phase_byte_ct;
+    r->phaseinfo = reinterpret_cast<uintptr_t *>(iter);
+    iter += phase_byte_ct;
+  }
+
+  // Mark the selected samples, or every sample, included (see the
+  // RpgenFullReader comment above for why this always takes the
+  // explicit-subset path).
+  const uint32_t raw_sample_ctv =
+      plink2::DivUp(file_sample_ct, plink2::kBitsPerVec);
+  const uint32_t raw_sample_ctaw = raw_sample_ctv * plink2::kWordsPerVec;
+  plink2::ZeroWArr(raw_sample_ctaw, r->subset_include_vec);
+  if (sample_idx) {
+    for (uint32_t i = 0; i != sample_ct; ++i) {
+      if (sample_idx[i] >= file_sample_ct) {
+        snprintf(errbuf, errbuf_len, "sample %u out of bounds (%u samples)",
+                 sample_idx[i] + 1, file_sample_ct);
+        return -1;
+      }
+      plink2::SetBit(sample_idx[i], r->subset_include_vec);
+    }
+  } else {
+    for (uint32_t i = 0; i != file_sample_ct; ++i) {
+      plink2::SetBit(i, r->subset_include_vec);
+    }
+  }
+  plink2::FillInterleavedMaskVec(r->subset_include_vec, raw_sample_ctv,
+                                  r->subset_include_interleaved_vec);
+  const uint32_t raw_sample_ctl =
+      plink2::DivUp(file_sample_ct, plink2::kBitsPerWord);
+  plink2::FillCumulativePopcounts(r->subset_include_vec, raw_sample_ctl,
+                                   r->subset_cumulative_popcounts);
+  plink2::PgrSetSampleSubsetIndex(r->subset_cumulative_popcounts, &r->state,
+                                   &r->subset_index);
+
+  r->n_sample = sample_idx ? sample_ct : file_sample_ct;
+  r->n_variant = r->info.raw_variant_ct;
+  return 0;
+}
+
 // Opens fname for reading, with `with_dosage` selecting whether the
 // dosage_present/dosage_main buffers PgrGetD() needs are also carved out (the
 // hardcalls-only reader has no use for them). On success, r->n_sample/
@@ -297,12 +445,18 @@ void rpgen_full_reader_release(RpgenFullReader *r) {
 // (it cannot be inferred) and infers raw_variant_ct from the file size if
 // not supplied, but rpgen_read_bed_hardcalls() always has both on hand
 // already, so it always supplies both explicitly.
+//
+// `sample_idx`, when not nullptr, holds `sample_ct` strictly increasing
+// 0-based sample indices: every read then decodes just those samples, in
+// file order, and r->n_sample is sample_ct.
 int rpgen_full_reader_open(const char *fname, bool with_dosage,
                             RpgenFullReader *r, char *errbuf,
                             size_t errbuf_len,
                             uint32_t cur_sample_ct = UINT32_MAX,
                             uint32_t cur_variant_ct = UINT32_MAX,
-                            bool with_phase = false) {
+                            bool with_phase = false,
+                            const uint32_t *sample_idx = nullptr,
+                            uint32_t sample_ct = 0) {
   if (errbuf_len > 0) {
     errbuf[0] = '\0';
   }
@@ -355,103 +509,10 @@ int rpgen_full_reader_open(const char *fname, bool with_dosage,
       goto cleanup;
     }
 
-    // pgr_alloc holds two regions back to back: PgrInit()'s own internal
-    // working set (pgr_alloc_main_byte_ct, opaque to us) followed by our own
-    // sample-subset/genovec/dosage buffers, carved out below exactly the way
-    // pgenlibr's Load() carves the same buffers out of its own larger
-    // pgr_alloc (it additionally reserves raregeno/difflist/multiallelic-
-    // patch/phase/transpose regions we don't need here).
-    const uint32_t file_sample_ct = r->info.raw_sample_ct;
-    const uintptr_t pgr_alloc_main_byte_ct =
-        pgr_alloc_cacheline_ct * plink2::kCacheline;
-    const uintptr_t sample_subset_byte_ct =
-        plink2::DivUp(file_sample_ct, plink2::kBitsPerVec) *
-        plink2::kBytesPerVec;
-    const uintptr_t cumulative_popcounts_byte_ct =
-        plink2::DivUp(file_sample_ct,
-                       plink2::kBitsPerWord * plink2::kInt32PerVec) *
-        plink2::kBytesPerVec;
-    const uintptr_t genovec_byte_ct =
-        plink2::DivUp(file_sample_ct, plink2::kNypsPerVec) *
-        plink2::kBytesPerVec;
-    const uintptr_t dosage_present_byte_ct =
-        with_dosage ? sample_subset_byte_ct : 0;
-    const uintptr_t dosage_main_byte_ct =
-        with_dosage ? plink2::DivUp(file_sample_ct,
-                                     2 * plink2::kInt32PerVec) *
-                           plink2::kBytesPerVec
-                    : 0;
-    const uintptr_t phase_byte_ct =
-        with_phase ? sample_subset_byte_ct : 0;
-    const uintptr_t extra_byte_ct =
-        2 * sample_subset_byte_ct + cumulative_popcounts_byte_ct +
-        genovec_byte_ct + dosage_present_byte_ct + dosage_main_byte_ct +
-        2 * phase_byte_ct;
-
-    if (plink2::cachealigned_malloc(pgr_alloc_main_byte_ct + extra_byte_ct,
-                                     &r->pgr_alloc)) {
-      snprintf(errbuf, errbuf_len, "out of memory (pgr_alloc)");
-      goto cleanup;
-    }
-
-    const plink2::PglErr reterr =
-        plink2::PgrInit(fname, max_vrec_width, &r->info, &r->state,
-                         r->pgr_alloc);
-    if (reterr != plink2::kPglRetSuccess) {
-      snprintf(errbuf, errbuf_len, "PgrInit() error %d",
-               static_cast<int>(reterr));
-      goto cleanup;
-    }
-
-    unsigned char *iter = &r->pgr_alloc[pgr_alloc_main_byte_ct];
-    r->subset_include_vec = reinterpret_cast<uintptr_t *>(iter);
-    iter += sample_subset_byte_ct;
-    r->subset_include_interleaved_vec = reinterpret_cast<uintptr_t *>(iter);
-    iter += sample_subset_byte_ct;
-#ifdef USE_AVX2
-    r->subset_include_interleaved_vec[-3] = 0;
-    r->subset_include_interleaved_vec[-2] = 0;
-#endif
-    r->subset_include_interleaved_vec[-1] = 0;
-    r->subset_cumulative_popcounts = reinterpret_cast<uint32_t *>(iter);
-    iter += cumulative_popcounts_byte_ct;
-    r->genovec = reinterpret_cast<uintptr_t *>(iter);
-    iter += genovec_byte_ct;
-    if (with_dosage) {
-      r->dosage_present = reinterpret_cast<uintptr_t *>(iter);
-      iter += dosage_present_byte_ct;
-      r->dosage_main = reinterpret_cast<uint16_t *>(iter);
-      iter += dosage_main_byte_ct;
-    }
-    if (with_phase) {
-      r->phasepresent = reinterpret_cast<uintptr_t *>(iter);
-      iter += phase_byte_ct;
-      r->phaseinfo = reinterpret_cast<uintptr_t *>(iter);
-      iter += phase_byte_ct;
-    }
-
-    // Mark every sample included (see the RpgenFullReader comment above for
-    // why this always takes the explicit-subset path).
-    const uint32_t raw_sample_ctv =
-        plink2::DivUp(file_sample_ct, plink2::kBitsPerVec);
-    const uint32_t raw_sample_ctaw = raw_sample_ctv * plink2::kWordsPerVec;
-    plink2::ZeroWArr(raw_sample_ctaw, r->subset_include_vec);
-    for (uint32_t sample_idx = 0; sample_idx != file_sample_ct;
-         ++sample_idx) {
-      plink2::SetBit(sample_idx, r->subset_include_vec);
-    }
-    plink2::FillInterleavedMaskVec(r->subset_include_vec, raw_sample_ctv,
-                                    r->subset_include_interleaved_vec);
-    const uint32_t raw_sample_ctl =
-        plink2::DivUp(file_sample_ct, plink2::kBitsPerWord);
-    plink2::FillCumulativePopcounts(r->subset_include_vec, raw_sample_ctl,
-                                     r->subset_cumulative_popcounts);
-    plink2::PgrSetSampleSubsetIndex(r->subset_cumulative_popcounts, &r->state,
-                                     &r->subset_index);
-
-    r->n_sample = file_sample_ct;
-    r->n_variant = raw_variant_ct;
-    rc = 0;
+    r->max_vrec_width = max_vrec_width;
+    r->pgr_alloc_cacheline_ct = pgr_alloc_cacheline_ct;
+    rc = rpgen_full_reader_attach(fname, with_dosage, with_phase, r, errbuf,
+                                  errbuf_len, sample_idx, sample_ct);
   }
 
 cleanup:
@@ -461,6 +522,36 @@ cleanup:
   return rc;
 }
 
+// Opens a second reader over src's file for another thread. It shares src's
+// variant index (pgenlib's PgenFileInfo is read-only once PgrInit() has
+// copied it) and gets its own FILE*, decoder state and read buffers, so the
+// two can read at once. src must stay open until r is released. The sample
+// selection is not copied: pass src's again. Returns like
+// rpgen_full_reader_open().
+int rpgen_full_reader_clone(const char *fname, const RpgenFullReader *src,
+                            bool with_dosage, bool with_phase,
+                            RpgenFullReader *r, char *errbuf,
+                            size_t errbuf_len,
+                            const uint32_t *sample_idx = nullptr,
+                            uint32_t sample_ct = 0) {
+  if (errbuf_len > 0) {
+    errbuf[0] = '\0';
+  }
+  rpgen_full_reader_preinit(r);
+  r->info = src->info;
+  r->info.shared_ff = nullptr;
+  r->owns_info = false;
+  r->max_vrec_width = src->max_vrec_width;
+  r->pgr_alloc_cacheline_ct = src->pgr_alloc_cacheline_ct;
+  const int rc = rpgen_full_reader_attach(fname, with_dosage, with_phase, r,
+                                          errbuf, errbuf_len, sample_idx,
+                                          sample_ct);
+  if (rc != 0) {
+    rpgen_full_reader_release(r);
+  }
+  return rc;
+}
+
 static int rpgen_full_reader_hardcalls(RpgenFullReader *r,
                                         uint32_t variant_start,
                                         uint32_t variant_ct, int32_t *out,
@@ -491,6 +582,27 @@ static int rpgen_full_reader_hardcalls(RpgenFullReader *r,
   return 0;
 }
 
+// Read one variant's hardcalls into the reader's genovec and leave them
+// packed: Rfmalloc's bed storage recodes the 2-bit genovec itself, so no
+// int32 record is built. The genovec stays valid until the next read.
+static int rpgen_full_reader_genovec(RpgenFullReader *r, uint32_t vidx,
+                                     char *errbuf, size_t errbuf_len) {
+  if (!r || vidx >= r->n_variant) {
+    snprintf(errbuf, errbuf_len, "variant %u out of bounds (raw_variant_ct = %u)",
+             vidx, r ? r->n_variant : 0);
+    return -1;
+  }
+  const plink2::PglErr reterr = plink2::PgrGet(
+      r->subset_include_vec, r->subset_index, r->n_sample, vidx, &r->state,
+      r->genovec);
+  if (reterr != plink2::kPglRetSuccess) {
+    snprintf(errbuf, errbuf_len, "PgrGet() error %d at variant %u",
+             static_cast<int>(reterr), vidx);
+    return -1;
+  }
+  return 0;
+}
+
 static int rpgen_full_reader_dosages(RpgenFullReader *r,
                                       uint32_t variant_start,
                                       uint32_t variant_ct, double *out,
@@ -524,9 +636,44 @@ static int rpgen_full_reader_dosages(RpgenFullReader *r,
   return 0;
 }
 
+// Read one variant's dosages and leave them in pgenlib's own form, in the
+// reader's buffers: the record points at them and stays valid until the next
+// read. Feeds Rfmalloc's 16-bit dosage storage with no double in between.
+static int rpgen_full_reader_dosage16(RpgenFullReader *r, uint32_t vidx,
+                                      Rfmalloc_buffer_dosage16 *rec,
+                                      char *errbuf, size_t errbuf_len) {
+  if (!r || !rec || !r->dosage_present || !r->dosage_main ||
+      vidx >= r->n_variant) {
+    snprintf(errbuf, errbuf_len, "variant %u out of bounds (raw_variant_ct = %u)",
+             vidx, r ? r->n_variant : 0);
+    return -1;
+  }
+  uint32_t dosage_ct;
+  const plink2::PglErr reterr = plink2::PgrGetD(
+      r->subset_include_vec, r->subset_index, r->n_sample, vidx, &r->state,
+      r->genovec, r->dosage_present, r->dosage_main, &dosage_ct);
+  if (reterr != plink2::kPglRetSuccess) {
+    snprintf(errbuf, errbuf_len, "PgrGetD() error %d at variant %u",
+             static_cast<int>(reterr), vidx);
+    return -1;
+  }
+  rec->genovec = r->genovec;
+  rec->dosage_present = r->dosage_present;
+  rec->dosage_main = r->dosage_main;
+  rec->dosage_ct = dosage_ct;
+  return 0;
+}
+
 // Read fully phased, nonmissing ref/nonref haplotypes into packed locus rows.
 // Bit 2*s is sample s's first haplotype and bit 2*s+1 is its second. This is
 // already the layout consumed by Rfmalloc's locus-major haplotype sink.
+//
+// That layout is the genovec's: one 2-bit slot per sample. So each genovec
+// word yields one output word for kBitsPerWordD2 samples at once. Hom-alt
+// (code 2) fills both bits, and a het (code 1) sets the bit its phase picks.
+// Phase and phasepresent are spread to the even bits with pgenlib's
+// UnpackHalfwordToWord(), which is PDEP on AVX2 builds and a shift cascade
+// otherwise.
 static int rpgen_full_reader_haplotypes(RpgenFullReader *r,
                                         uint32_t variant_start,
                                         uint32_t variant_ct, uint8_t *out,
@@ -542,6 +689,14 @@ static int rpgen_full_reader_haplotypes(RpgenFullReader *r,
     snprintf(errbuf, errbuf_len, "phased-haplotype row buffer is too short");
     return -1;
   }
+  const uint32_t word_ct = plink2::NypCtToWordCt(r->n_sample);
+  const uint32_t tail = r->n_sample % plink2::kBitsPerWordD2;
+  const uintptr_t tail_mask =
+      tail ? (~static_cast<uintptr_t>(0)) >> (plink2::kBitsPerWord - 2 * tail)
+           : ~static_cast<uintptr_t>(0);
+  const plink2::Halfword *present_hw =
+      plink2::DowncastKWToHW(r->phasepresent);
+  const plink2::Halfword *phase_hw = plink2::DowncastKWToHW(r->phaseinfo);
 
   for (uint32_t i = 0; i != variant_ct; ++i) {
     const uint32_t vidx = variant_start + i;
@@ -557,28 +712,36 @@ static int rpgen_full_reader_haplotypes(RpgenFullReader *r,
     }
 
     uint8_t *row = out + (size_t)i * out_stride;
-    memset(row, 0, row_bytes);
-    for (uint32_t s = 0; s != r->n_sample; ++s) {
-      const uint32_t code = (r->genovec[s / plink2::kBitsPerWordD2] >>
-                             (2 * (s % plink2::kBitsPerWordD2))) & 3;
-      if (code == 3) {
+    for (uint32_t w = 0; w != word_ct; ++w) {
+      uintptr_t geno = r->genovec[w];
+      if (w + 1 == word_ct) {
+        geno &= tail_mask;
+      }
+      const uintptr_t lo = geno & plink2::kMask5555;
+      const uintptr_t hi = (geno >> 1) & plink2::kMask5555;
+      const uintptr_t het = lo & ~hi;
+      // phasepresent is left unwritten when no sample is phased.
+      const uintptr_t present =
+          phasepresent_ct ? plink2::UnpackHalfwordToWord(present_hw[w]) : 0;
+      const uintptr_t bad = (lo & hi) | (het & ~present);
+      if (bad) {
+        const uint32_t bit = plink2::ctzw(bad);
+        const uint32_t s = w * plink2::kBitsPerWordD2 + bit / 2;
         snprintf(errbuf, errbuf_len,
-                 "missing genotype at variant %u, sample %u", vidx, s);
+                 (hi >> bit) & 1 ? "missing genotype at variant %u, sample %u"
+                                 : "unphased heterozygote at variant %u, "
+                                   "sample %u",
+                 vidx, s);
         return -1;
       }
-      const size_t h0 = (size_t)s * 2;
-      if (code == 2) {
-        row[h0 >> 3] |= (uint8_t)(1u << (h0 & 7));
-        row[(h0 + 1) >> 3] |= (uint8_t)(1u << ((h0 + 1) & 7));
-      } else if (code == 1) {
-        if (!plink2::IsSet(r->phasepresent, s)) {
-          snprintf(errbuf, errbuf_len,
-                   "unphased heterozygote at variant %u, sample %u", vidx, s);
-          return -1;
-        }
-        const size_t alt_hap = h0 + (plink2::IsSet(r->phaseinfo, s) ? 0 : 1);
-        row[alt_hap >> 3] |= (uint8_t)(1u << (alt_hap & 7));
-      }
+      // hi is now exactly the hom-alt slots; phaseinfo set puts the alt
+      // allele on the first haplotype.
+      const uintptr_t first =
+          het & plink2::UnpackHalfwordToWord(phase_hw[w]);
+      const uintptr_t haps = (hi * 3) | first | ((het ^ first) << 1);
+      const size_t at = (size_t)w * sizeof(uintptr_t);
+      std::memcpy(row + at, &haps,
+                  std::min(sizeof(uintptr_t), row_bytes - at));
     }
   }
   return 0;
@@ -738,6 +901,498 @@ int rpgen_read_bed_hardcalls(const char *bed_fname, uint32_t raw_sample_ct,
   return rc;
 }
 
+// -- lazy PGEN tensors -------------------------------------------------------
+//
+// Rpgen registers an Rfmalloc tensor codec, "pgen", whose payload is a
+// handle to a .pgen (or PLINK 1 .bed) file instead of a copy of its
+// genotypes. Decoding an element range reads the variants it covers through
+// pgenlib, so fmalloc_tensor_materialize(), the panel-streamed products and
+// every Rfmalloc_tensor_decode() consumer run straight against the file.
+// The payload, in native byte order like Rfmalloc's own payload headers, is
+//
+//   RpgenTensorHeader | path, NUL-terminated, padded to 4 bytes |
+//   n_sample sample indices (with kRpgenTensorSamples) |
+//   n_variant variant indices (with kRpgenTensorVariants)
+//
+// with 0-based, strictly increasing uint32 indices into the file.
+constexpr char kRpgenTensorMagic[8] = {'R', 'P', 'G', 'E', 'N', 'T', 'N', '1'};
+constexpr uint32_t kRpgenTensorSamples = 1;
+constexpr uint32_t kRpgenTensorVariants = 2;
+
+struct RpgenTensorHeader {
+  char magic[8];
+  uint32_t kind;  // 0: hardcalls, 1: dosages
+  uint32_t flags;
+  uint32_t raw_sample_ct;
+  uint32_t raw_variant_ct;
+  uint32_t n_sample;   // rows: selected samples
+  uint32_t n_variant;  // columns: selected variants
+  uint32_t threads;    // decoding threads per decode call
+  uint32_t path_bytes; // with the NUL, before padding
+};
+
+struct RpgenTensorView {
+  const RpgenTensorHeader *hdr;
+  const char *path;
+  const uint32_t *sample_idx;   // nullptr: every sample
+  const uint32_t *variant_idx;  // nullptr: every variant
+};
+
+size_t rpgen_tensor_payload_bytes(uint32_t path_bytes, uint32_t flags,
+                                  uint32_t n_sample, uint32_t n_variant) {
+  size_t bytes = sizeof(RpgenTensorHeader) + (((size_t)path_bytes + 3) & ~(size_t)3);
+  if (flags & kRpgenTensorSamples) {
+    bytes += (size_t)n_sample * sizeof(uint32_t);
+  }
+  if (flags & kRpgenTensorVariants) {
+    bytes += (size_t)n_variant * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+// Returns 0 with v filled, or -1 for a malformed payload. A decode does not
+// know its payload's size and passes SIZE_MAX: Rfmalloc has already checked
+// the payload against rpgen_tensor_extent().
+int rpgen_tensor_parse(const void *payload, size_t payload_bytes,
+                       RpgenTensorView *v) {
+  const RpgenTensorHeader *h = static_cast<const RpgenTensorHeader *>(payload);
+  if (!payload || payload_bytes < sizeof(RpgenTensorHeader) ||
+      std::memcmp(h->magic, kRpgenTensorMagic, sizeof(h->magic)) != 0 ||
+      h->kind > 1 || (h->flags & ~(kRpgenTensorSamples | kRpgenTensorVariants)) ||
+      h->n_sample == 0 || h->n_sample > h->raw_sample_ct ||
+      h->n_variant == 0 || h->n_variant > h->raw_variant_ct ||
+      h->threads == 0 || h->path_bytes < 2 ||
+      rpgen_tensor_payload_bytes(h->path_bytes, h->flags, h->n_sample,
+                                 h->n_variant) > payload_bytes) {
+    return -1;
+  }
+  const char *path = reinterpret_cast<const char *>(h + 1);
+  if (path[h->path_bytes - 1] != '\0') {
+    return -1;
+  }
+  const uint32_t *idx = reinterpret_cast<const uint32_t *>(
+      path + (((size_t)h->path_bytes + 3) & ~(size_t)3));
+  v->hdr = h;
+  v->path = path;
+  v->sample_idx = nullptr;
+  v->variant_idx = nullptr;
+  if (h->flags & kRpgenTensorSamples) {
+    v->sample_idx = idx;
+    idx += h->n_sample;
+  }
+  if (h->flags & kRpgenTensorVariants) {
+    v->variant_idx = idx;
+  }
+  return 0;
+}
+
+// The payload addresses one byte per decoded element: with Rfmalloc's
+// one-byte blocks, that makes every tensor of the payload's shape fit.
+size_t rpgen_tensor_extent(const void *payload, size_t payload_bytes) {
+  RpgenTensorView v;
+  if (rpgen_tensor_parse(payload, payload_bytes, &v) != 0) {
+    return 0;
+  }
+  return (size_t)v.hdr->n_sample * (size_t)v.hdr->n_variant;
+}
+
+// Readers over one file, kind and sample selection, shared by every tensor
+// that names them. readers[0] owns the variant index and the rest are clones
+// over it, opened when concurrent decodes need more and kept between
+// decodes. A file that is rewritten gets a new entry, since its index is
+// stale, and so does one whose reader failed. An entry with no reader in use
+// can be closed to make room.
+struct RpgenTensorFile {
+  std::string path;
+  uint32_t kind;
+  uint32_t raw_sample_ct;
+  uint32_t raw_variant_ct;
+  std::vector<uint32_t> samples;  // empty: every sample
+  int64_t mtime;
+  int64_t size;
+  uint32_t serial;  // keys the file's variants in the decoded-variant cache
+  std::vector<std::unique_ptr<RpgenFullReader>> readers;
+  std::vector<RpgenFullReader *> idle;
+  uint32_t in_use;  // readers handed out, plus decodes holding the entry
+  uint64_t last_use;
+  bool failed;  // a reader failed: never matched again, closed when released
+};
+
+// Decoded variants, least recently used first out. A column of doubles
+// costs 8 bytes per sample to decode into but many pgenlib reads to produce,
+// so repeated passes over a tensor (an iterative solver's products) skip
+// pgenlib for whatever still fits.
+struct RpgenTensorCacheEntry {
+  std::shared_ptr<const std::vector<double>> column;
+  std::list<uint64_t>::iterator lru;
+};
+
+constexpr size_t kRpgenTensorMaxFiles = 8;
+
+struct RpgenTensorPool {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<RpgenTensorFile>> files;
+  uint64_t clock = 0;
+  uint32_t next_serial = 1;
+  size_t cache_limit = (size_t)256 << 20;
+  size_t cache_bytes = 0;
+  std::list<uint64_t> lru;  // front: most recent
+  std::unordered_map<uint64_t, RpgenTensorCacheEntry> cache;
+  // Why the last failed decode of each path failed, until Rfmalloc asks for
+  // it through rpgen_tensor_error().
+  std::unordered_map<std::string, std::string> errors;
+};
+
+RpgenTensorPool rpgen_tensor_pool;
+
+// Records a failed decode's reason for path, pgenlib's trailing newline
+// dropped. The caller holds the pool lock.
+void rpgen_tensor_note_error(RpgenTensorPool &pool, const std::string &path,
+                             const char *what, const char *errbuf) {
+  std::string msg(what);
+  if (errbuf && errbuf[0]) {
+    msg += ": ";
+    msg += errbuf;
+    while (!msg.empty() && (msg.back() == '\n' || msg.back() == ' ')) {
+      msg.pop_back();
+    }
+  }
+  pool.errors[path] = std::move(msg);
+}
+
+void rpgen_tensor_cache_trim(RpgenTensorPool &pool, size_t limit) {
+  while (pool.cache_bytes > limit && !pool.lru.empty()) {
+    auto it = pool.cache.find(pool.lru.back());
+    pool.cache_bytes -= it->second.column->size() * sizeof(double);
+    pool.cache.erase(it);
+    pool.lru.pop_back();
+  }
+}
+
+void rpgen_tensor_file_close(RpgenTensorPool &pool, RpgenTensorFile *f) {
+  for (auto it = pool.cache.begin(); it != pool.cache.end();) {
+    if ((uint32_t)(it->first >> 32) == f->serial) {
+      pool.cache_bytes -= it->second.column->size() * sizeof(double);
+      pool.lru.erase(it->second.lru);
+      it = pool.cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // Clones borrow the first reader's variant index: release it last.
+  for (size_t i = f->readers.size(); i-- > 0;) {
+    rpgen_full_reader_release(f->readers[i].get());
+  }
+}
+
+// Finds or opens the entry for v's file and holds it until
+// rpgen_tensor_file_done(). Returns nullptr if the file cannot be opened.
+RpgenTensorFile *rpgen_tensor_file_hold(const RpgenTensorView &v) {
+  RpgenTensorPool &pool = rpgen_tensor_pool;
+  struct stat st;
+  if (stat(v.path, &st) != 0) {
+    const char *reason = strerror(errno);
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    rpgen_tensor_note_error(pool, v.path, "cannot stat the file", reason);
+    return nullptr;
+  }
+  const RpgenTensorHeader *h = v.hdr;
+  const uint32_t n_selected = v.sample_idx ? h->n_sample : 0;
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  for (auto &f : pool.files) {
+    if (!f->failed && f->kind == h->kind && f->raw_sample_ct == h->raw_sample_ct &&
+        f->raw_variant_ct == h->raw_variant_ct &&
+        f->mtime == (int64_t)st.st_mtime && f->size == (int64_t)st.st_size &&
+        f->samples.size() == n_selected && f->path == v.path &&
+        (n_selected == 0 ||
+         std::memcmp(f->samples.data(), v.sample_idx,
+                     n_selected * sizeof(uint32_t)) == 0)) {
+      f->in_use++;
+      f->last_use = ++pool.clock;
+      return f.get();
+    }
+  }
+  std::unique_ptr<RpgenTensorFile> f(new RpgenTensorFile());
+  f->path = v.path;
+  f->kind = h->kind;
+  f->raw_sample_ct = h->raw_sample_ct;
+  f->raw_variant_ct = h->raw_variant_ct;
+  if (v.sample_idx) {
+    f->samples.assign(v.sample_idx, v.sample_idx + h->n_sample);
+  }
+  f->mtime = (int64_t)st.st_mtime;
+  f->size = (int64_t)st.st_size;
+  f->serial = pool.next_serial++;
+  f->failed = false;
+  f->readers.emplace_back(new RpgenFullReader());
+  char errbuf[512];
+  if (rpgen_full_reader_open(v.path, h->kind == 1, f->readers[0].get(), errbuf,
+                             sizeof(errbuf), h->raw_sample_ct,
+                             h->raw_variant_ct, false, v.sample_idx,
+                             n_selected) != 0) {
+    rpgen_tensor_note_error(pool, f->path, "failed to open", errbuf);
+    return nullptr;
+  }
+  f->idle.push_back(f->readers[0].get());
+  f->in_use = 1;
+  f->last_use = ++pool.clock;
+  // Close the least recently used entries no decode is holding.
+  while (pool.files.size() >= kRpgenTensorMaxFiles) {
+    auto victim = pool.files.end();
+    for (auto it = pool.files.begin(); it != pool.files.end(); ++it) {
+      if ((*it)->in_use == 0 &&
+          (victim == pool.files.end() || (*it)->last_use < (*victim)->last_use)) {
+        victim = it;
+      }
+    }
+    if (victim == pool.files.end()) {
+      break;
+    }
+    rpgen_tensor_file_close(pool, victim->get());
+    pool.files.erase(victim);
+  }
+  pool.files.push_back(std::move(f));
+  return pool.files.back().get();
+}
+
+void rpgen_tensor_file_done(RpgenTensorFile *f) {
+  RpgenTensorPool &pool = rpgen_tensor_pool;
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  f->in_use--;
+  f->last_use = ++pool.clock;
+  if (f->failed && f->in_use == 0) {
+    rpgen_tensor_file_close(pool, f);
+    for (auto it = pool.files.begin(); it != pool.files.end(); ++it) {
+      if (it->get() == f) {
+        pool.files.erase(it);
+        break;
+      }
+    }
+  }
+}
+
+// An idle reader of f, or a new clone when every reader is busy. The clone
+// is opened outside the pool lock; nullptr if it cannot be.
+RpgenFullReader *rpgen_tensor_reader_take(RpgenTensorFile *f) {
+  RpgenFullReader *primary;
+  {
+    std::lock_guard<std::mutex> lock(rpgen_tensor_pool.mutex);
+    if (!f->idle.empty()) {
+      RpgenFullReader *r = f->idle.back();
+      f->idle.pop_back();
+      return r;
+    }
+    primary = f->readers[0].get();
+  }
+  std::unique_ptr<RpgenFullReader> r(new RpgenFullReader());
+  char errbuf[512];
+  if (rpgen_full_reader_clone(f->path.c_str(), primary, f->kind == 1, false,
+                              r.get(), errbuf, sizeof(errbuf),
+                              f->samples.empty() ? nullptr : f->samples.data(),
+                              (uint32_t)f->samples.size()) != 0) {
+    std::lock_guard<std::mutex> lock(rpgen_tensor_pool.mutex);
+    rpgen_tensor_note_error(rpgen_tensor_pool, f->path, "failed to open a reader",
+                            errbuf);
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(rpgen_tensor_pool.mutex);
+  f->readers.push_back(std::move(r));
+  return f->readers.back().get();
+}
+
+void rpgen_tensor_reader_give(RpgenTensorFile *f, RpgenFullReader *r) {
+  std::lock_guard<std::mutex> lock(rpgen_tensor_pool.mutex);
+  f->idle.push_back(r);
+}
+
+// Takes a reader whose read failed out of service instead of giving it back,
+// recording why. A clone is released now; the primary holds the variant index
+// the clones borrow, so it goes when the failed entry is closed.
+void rpgen_tensor_reader_drop(RpgenTensorFile *f, RpgenFullReader *r,
+                              uint32_t vidx, const char *errbuf) {
+  std::unique_ptr<RpgenFullReader> clone;
+  {
+    RpgenTensorPool &pool = rpgen_tensor_pool;
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    char what[64];
+    snprintf(what, sizeof(what), "failed to read variant %u", vidx + 1);
+    rpgen_tensor_note_error(pool, f->path, what, errbuf);
+    f->failed = true;
+    for (size_t i = 1; i < f->readers.size(); i++) {
+      if (f->readers[i].get() == r) {
+        clone = std::move(f->readers[i]);
+        f->readers.erase(f->readers.begin() + (std::ptrdiff_t)i);
+        break;
+      }
+    }
+  }
+  if (clone) {
+    rpgen_full_reader_release(clone.get());
+  }
+}
+
+// Decode file variant vidx into n_sample doubles: 0/1/2 alt copies with NA
+// for a missing hardcall, or PgrGetD() dosages. pgenlib's message is left in
+// errbuf on failure.
+int rpgen_tensor_read(RpgenFullReader *r, uint32_t kind, uint32_t vidx,
+                      double *out, char *errbuf, size_t errbuf_len) {
+  if (kind == 1) {
+    return rpgen_full_reader_dosages(r, vidx, 1, out, errbuf, errbuf_len);
+  }
+  if (rpgen_full_reader_genovec(r, vidx, errbuf, errbuf_len) != 0) {
+    return -1;
+  }
+  plink2::GenoarrLookup16x8bx2(r->genovec, kGenoRDoublePairs, r->n_sample,
+                               out);
+  return 0;
+}
+
+// The codec's decode. Cached variants are copied out; the rest are split
+// over the payload's thread count, each thread reading with its own reader,
+// and added to the cache. Never calls the R API.
+int rpgen_tensor_decode(const void *payload, R_xlen_t elem_offset,
+                        R_xlen_t n_elems, double *out) {
+  RpgenTensorView v;
+  if (rpgen_tensor_parse(payload, SIZE_MAX, &v) != 0 || elem_offset < 0 ||
+      n_elems < 0 || !out) {
+    return -1;
+  }
+  const R_xlen_t n_sample = v.hdr->n_sample;
+  if (elem_offset + n_elems > n_sample * (R_xlen_t)v.hdr->n_variant) {
+    return -1;
+  }
+  if (n_elems == 0) {
+    return 0;
+  }
+  const R_xlen_t col_first = elem_offset / n_sample;
+  const R_xlen_t col_last = (elem_offset + n_elems - 1) / n_sample;
+  const R_xlen_t elem_end = elem_offset + n_elems;
+  // Copy the part of column col (all of it, or the ends of the range) that
+  // lies in the range.
+  auto place = [&](R_xlen_t col, const double *column) {
+    const R_xlen_t lo = std::max(col * n_sample, elem_offset);
+    const R_xlen_t hi = std::min((col + 1) * n_sample, elem_end);
+    double *dst = out + (lo - elem_offset);
+    const double *src = column + (lo - col * n_sample);
+    if (dst != src) {
+      std::memcpy(dst, src, (size_t)(hi - lo) * sizeof(double));
+    }
+  };
+  auto variant_of = [&](R_xlen_t col) {
+    return v.variant_idx ? v.variant_idx[col] : (uint32_t)col;
+  };
+
+  RpgenTensorFile *f = rpgen_tensor_file_hold(v);
+  if (!f) {
+    return -1;
+  }
+  const uint64_t key_base = (uint64_t)f->serial << 32;
+  RpgenTensorPool &pool = rpgen_tensor_pool;
+  std::vector<R_xlen_t> missing;
+  size_t cache_limit;
+  {
+    std::vector<std::shared_ptr<const std::vector<double>>> hits;
+    std::vector<R_xlen_t> hit_cols;
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      cache_limit = pool.cache_limit;
+      for (R_xlen_t col = col_first; col <= col_last; col++) {
+        auto it = pool.cache.find(key_base | variant_of(col));
+        if (it == pool.cache.end()) {
+          missing.push_back(col);
+          continue;
+        }
+        pool.lru.splice(pool.lru.begin(), pool.lru, it->second.lru);
+        hits.push_back(it->second.column);
+        hit_cols.push_back(col);
+      }
+    }
+    for (size_t i = 0; i < hits.size(); i++) {
+      place(hit_cols[i], hits[i]->data());
+    }
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> failed(0);
+  const size_t column_bytes = (size_t)n_sample * sizeof(double);
+  auto work = [&]() {
+    RpgenFullReader *r = rpgen_tensor_reader_take(f);
+    if (!r) {
+      failed = 1;
+      return;
+    }
+    std::vector<double> scratch;
+    char errbuf[512];
+    for (size_t i = next++; i < missing.size() && !failed; i = next++) {
+      const R_xlen_t col = missing[i];
+      const bool whole = col * n_sample >= elem_offset &&
+                         (col + 1) * n_sample <= elem_end;
+      if (!whole) {
+        scratch.resize((size_t)n_sample);
+      }
+      double *dst = whole ? out + (col * n_sample - elem_offset) : scratch.data();
+      if (rpgen_tensor_read(r, f->kind, variant_of(col), dst, errbuf,
+                            sizeof(errbuf)) != 0) {
+        rpgen_tensor_reader_drop(f, r, variant_of(col), errbuf);
+        failed = 1;
+        return;
+      }
+      place(col, dst);
+      if (column_bytes > cache_limit) {
+        continue;
+      }
+      auto copy = std::make_shared<const std::vector<double>>(dst, dst + n_sample);
+      const uint64_t key = key_base | variant_of(col);
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (pool.cache.find(key) == pool.cache.end()) {
+        pool.lru.push_front(key);
+        pool.cache[key] = RpgenTensorCacheEntry{copy, pool.lru.begin()};
+        pool.cache_bytes += column_bytes;
+        rpgen_tensor_cache_trim(pool, pool.cache_limit);
+      }
+    }
+    rpgen_tensor_reader_give(f, r);
+  };
+  if (missing.empty()) {
+    rpgen_tensor_file_done(f);
+    return 0;
+  }
+  const size_t n_thread = std::min<size_t>(v.hdr->threads, missing.size());
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < n_thread; t++) {
+    try {
+      threads.emplace_back(work);
+    } catch (...) {
+      break;  // the threads already started, and this one, do the rest
+    }
+  }
+  work();
+  for (auto &t : threads) {
+    t.join();
+  }
+  rpgen_tensor_file_done(f);
+  return failed ? -1 : 0;
+}
+
+// The codec's error function: why the last decode of the payload's file
+// failed, as "<path>: <reason>". The reason is handed out once.
+int rpgen_tensor_error(const void *payload, char *buf, size_t buf_len) {
+  RpgenTensorView v;
+  if (rpgen_tensor_parse(payload, SIZE_MAX, &v) != 0) {
+    snprintf(buf, buf_len, "malformed \"pgen\" payload");
+    return 0;
+  }
+  RpgenTensorPool &pool = rpgen_tensor_pool;
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  auto it = pool.errors.find(v.path);
+  if (it == pool.errors.end()) {
+    return -1;
+  }
+  snprintf(buf, buf_len, "%s: %s", v.path, it->second.c_str());
+  pool.errors.erase(it);
+  return 0;
+}
+
 }  // namespace
 
 extern "C" {
@@ -820,6 +1475,57 @@ SEXP RC_rpgen_info(SEXP path_sexp) {
   return result;
 }
 
+// CHROM, POS and ID of every variant in a .pvar (plain or .zst) or .bim,
+// through pgenlib's minimal .pvar loader: list(chrom, pos, id), one element
+// per variant in file order.
+SEXP RC_rpgen_read_variants(SEXP path_sexp) {
+  if (TYPEOF(path_sexp) != STRSXP || Rf_length(path_sexp) != 1 ||
+      STRING_ELT(path_sexp, 0) == NA_STRING) {
+    Rf_error("path must be a single non-NA string");
+  }
+  const char *path = CHAR(STRING_ELT(path_sexp, 0));
+
+  plink2::MinimalPvar pvar;
+  plink2::PreinitMinimalPvar(&pvar);
+  char pgenlib_errbuf[plink2::kPglErrstrBufBlen];
+  if (plink2::LoadMinimalPvarEx(path, plink2::kfLoadMinimalPvar0, &pvar,
+                                 pgenlib_errbuf) != plink2::kPglRetSuccess) {
+    plink2::CleanupMinimalPvar(&pvar);
+    Rf_error("failed to read \"%s\": %s", path, &pgenlib_errbuf[7]);
+  }
+  const uint32_t n_variant = pvar.variant_ct;
+  if (n_variant > static_cast<uint32_t>(INT_MAX)) {
+    plink2::CleanupMinimalPvar(&pvar);
+    Rf_error("\"%s\" has too many variants for R vectors", path);
+  }
+
+  SEXP result = PROTECT(Rf_allocVector(VECSXP, 3));
+  SEXP chr_names = PROTECT(Rf_allocVector(STRSXP, pvar.chr_ct));
+  for (uint32_t c = 0; c != pvar.chr_ct; ++c) {
+    SET_STRING_ELT(chr_names, c, Rf_mkChar(pvar.chr_names[c]));
+  }
+  SEXP chrom = Rf_allocVector(STRSXP, n_variant);
+  SET_VECTOR_ELT(result, 0, chrom);
+  SEXP pos = Rf_allocVector(INTSXP, n_variant);
+  SET_VECTOR_ELT(result, 1, pos);
+  SEXP id = Rf_allocVector(STRSXP, n_variant);
+  SET_VECTOR_ELT(result, 2, id);
+  for (uint32_t v = 0; v != n_variant; ++v) {
+    SET_STRING_ELT(chrom, v, STRING_ELT(chr_names, pvar.chr_idxs[v]));
+    INTEGER(pos)[v] = pvar.variant_bps[v];
+    SET_STRING_ELT(id, v, Rf_mkChar(pvar.variant_ids[v]));
+  }
+  plink2::CleanupMinimalPvar(&pvar);
+
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, 3));
+  SET_STRING_ELT(names, 0, Rf_mkChar("chrom"));
+  SET_STRING_ELT(names, 1, Rf_mkChar("pos"));
+  SET_STRING_ELT(names, 2, Rf_mkChar("id"));
+  Rf_setAttrib(result, R_NamesSymbol, names);
+  UNPROTECT(3);
+  return result;
+}
+
 // Shared argument validation for RC_rpgen_read_hardcalls()/
 // RC_rpgen_read_dosages(): `path` must be a single non-NA string; `pvar` must
 // be NULL or a single string. `pvar` is accepted for API parity with the
@@ -934,122 +1640,572 @@ static uint32_t rpgen_check_count(SEXP x, const char *argname) {
 
 static void rpgen_interrupt_check(void *) { R_CheckUserInterrupt(); }
 
-// Stream one open pgenlib reader into Rfmalloc's record-panel context. The
-// source declares the transfer representation; Rfmalloc owns packing,
-// alignment, and persistent layout.
+// One decoding thread of RC_rpgen_stream_fmalloc(): its own reader, its QC
+// counts, the first block it failed on, if any, and the time it spent
+// decoding.
+struct RpgenStreamWorker {
+  RpgenFullReader reader;
+  RpgenQcCounter qc;      // sized only when QC was asked for
+  uint32_t failed_block;  // UINT32_MAX when none
+  int status;             // 1: the reader failed, 2: Rfmalloc refused a write
+  double decode_seconds;
+  char errbuf[512];
+};
+
+// The panel ring's budget. Panels shrink so that threads + 2 of them fit,
+// down to one variant each.
+constexpr size_t kRpgenStreamRingBytes = (size_t)256 << 20;
+
+// A panel of the ring between the decoders and the writer, and the block it
+// holds once decoded.
+struct RpgenStreamPanel {
+  void *data;
+  uint32_t block;
+};
+
+// 16-bit dosage records point into the reader's buffers, which the next
+// PgrGetD() overwrites. A panel copies each variant's genovec,
+// dosage_present and dosage_main into a slot of this many bytes, each part
+// rounded up to whole words.
+static size_t rpgen_dosage16_slot_bytes(uint32_t n_sample) {
+  return (((size_t)n_sample + 31) / 32) * 8 +
+         (((size_t)n_sample + 63) / 64) * 8 +
+         (((size_t)n_sample + 3) / 4) * 8;
+}
+
+// Decode records [first, first + count) into a panel with room for capacity
+// records. Record i is file variant variant_idx[i], or i when variant_idx is
+// nullptr; pgenlib seeks past the variants a selection skips. Consecutive
+// dosage and haplotype records are read as one block; hardcalls and 16-bit
+// dosages are copied out of the reader one variant at a time, so the panel
+// owns every byte the writer reads. Never calls the R API. Returns 0, or 1
+// with the reader's message in w->errbuf.
+//
+// With qc_counts, each record's genovec (the hardcalls pgenlib decodes
+// alongside dosages and phase) is also added to w->qc, and its counts go to
+// qc_counts[4 * (first + i)]. Dosage and haplotype blocks are then read one
+// variant at a time, so every genovec is seen before the next read.
+static int rpgen_stream_decode(RpgenStreamWorker *w, int kind, uint32_t first,
+                               uint32_t count, uint32_t capacity,
+                               size_t record_stride,
+                               const uint32_t *variant_idx, void *panel,
+                               uint32_t *qc_counts) {
+  RpgenFullReader *r = &w->reader;
+  char *errbuf = w->errbuf;
+  const size_t errbuf_len = sizeof(w->errbuf);
+  uint8_t *out = static_cast<uint8_t *>(panel);
+  if (qc_counts) {
+    qc_counts += (size_t)first * 4;
+  }
+  if (kind == 1 || kind == 2 || kind == 3) {
+    const uint32_t run = variant_idx || qc_counts ? 1 : count;
+    for (uint32_t i = 0; i < count; i += run) {
+      const uint32_t vidx = variant_idx ? variant_idx[first + i] : first + i;
+      uint8_t *dst = out + (size_t)i * record_stride;
+      const int rc = kind == 2
+          ? rpgen_full_reader_haplotypes(r, vidx, run, dst, record_stride,
+                                         errbuf, errbuf_len)
+          : rpgen_full_reader_dosages(r, vidx, run,
+                                      reinterpret_cast<double *>(dst), errbuf,
+                                      errbuf_len);
+      if (rc != 0) {
+        return 1;
+      }
+      if (qc_counts) {
+        rpgen_qc_add(&w->qc, r->genovec, qc_counts + (size_t)i * 4);
+      }
+    }
+    return 0;
+  }
+  if (kind == 0) {
+    for (uint32_t i = 0; i != count; ++i) {
+      const uint32_t vidx = variant_idx ? variant_idx[first + i] : first + i;
+      if (rpgen_full_reader_genovec(r, vidx, errbuf, errbuf_len) != 0) {
+        return 1;
+      }
+      std::memcpy(out + (size_t)i * record_stride, r->genovec, record_stride);
+      if (qc_counts) {
+        rpgen_qc_add(&w->qc, r->genovec, qc_counts + (size_t)i * 4);
+      }
+    }
+    return 0;
+  }
+  const size_t n_sample = r->n_sample;
+  const size_t geno_bytes = ((n_sample + 31) / 32) * 8;
+  const size_t present_bytes = ((n_sample + 63) / 64) * 8;
+  const size_t slot_bytes = rpgen_dosage16_slot_bytes(r->n_sample);
+  Rfmalloc_buffer_dosage16 *recs =
+      static_cast<Rfmalloc_buffer_dosage16 *>(panel);
+  uint8_t *slot = out + (size_t)capacity * sizeof(Rfmalloc_buffer_dosage16);
+  for (uint32_t i = 0; i != count; ++i, slot += slot_bytes) {
+    const uint32_t vidx = variant_idx ? variant_idx[first + i] : first + i;
+    Rfmalloc_buffer_dosage16 rec;
+    if (rpgen_full_reader_dosage16(r, vidx, &rec, errbuf, errbuf_len) != 0) {
+      return 1;
+    }
+    if (qc_counts) {
+      rpgen_qc_add(&w->qc, r->genovec, qc_counts + (size_t)i * 4);
+    }
+    std::memcpy(slot, rec.genovec, (n_sample + 3) / 4);
+    std::memcpy(slot + geno_bytes, rec.dosage_present, (n_sample + 7) / 8);
+    std::memcpy(slot + geno_bytes + present_bytes, rec.dosage_main,
+                (size_t)rec.dosage_ct * sizeof(uint16_t));
+    recs[i].genovec = slot;
+    recs[i].dosage_present = slot + geno_bytes;
+    recs[i].dosage_main =
+        reinterpret_cast<const uint16_t *>(slot + geno_bytes + present_bytes);
+    recs[i].dosage_ct = rec.dosage_ct;
+  }
+  return 0;
+}
+
+// Everything RC_rpgen_stream_fmalloc() holds outside R: the buffer context,
+// the decoders' readers and QC counters, the panel ring and the per-variant
+// QC counts. It is owned by an external pointer, so an R error or interrupt
+// releases it. The stream frees it explicitly before each Rf_error(), and
+// the finalizer covers errors raised inside the R API it calls.
+struct RpgenStreamState {
+  Rfmalloc_buffer_context *sink = nullptr;
+  Rfmalloc_buffer_abort_fun abort = nullptr;
+  std::vector<RpgenStreamWorker> workers;
+  size_t n_open = 0;  // workers whose reader is open
+  std::vector<RpgenStreamPanel> panels;
+  std::vector<RpgenStreamPanel *> idle, queued;
+  std::vector<uint32_t> qc_counts;
+  std::vector<std::thread> pool;  // decoders, joined before any error
+  std::mutex lock;
+  std::condition_variable panel_freed, panel_queued;
+
+  ~RpgenStreamState() {
+    // Clones borrow the first reader's variant index: release it last.
+    for (size_t t = n_open; t-- > 0;) {
+      rpgen_full_reader_release(&workers[t].reader);
+    }
+    for (RpgenStreamPanel &p : panels) {
+      std::free(p.data);
+    }
+    if (sink) {
+      abort(sink);
+    }
+  }
+};
+
+static void rpgen_stream_finalizer(SEXP owner) {
+  delete static_cast<RpgenStreamState *>(R_ExternalPtrAddr(owner));
+  R_ClearExternalPtr(owner);
+}
+
+// NULL, or strictly increasing 1-based indices into 1..n, returned 0-based
+// in an R_alloc() buffer that lives until the .Call returns.
+static const uint32_t *rpgen_check_selection(SEXP x, uint32_t n,
+                                             const char *argname) {
+  if (x == R_NilValue) {
+    return nullptr;
+  }
+  if ((TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP) || XLENGTH(x) < 1 ||
+      XLENGTH(x) > n) {
+    Rf_error("%s must be NULL or a non-empty numeric vector", argname);
+  }
+  const R_xlen_t len = XLENGTH(x);
+  uint32_t *idx =
+      reinterpret_cast<uint32_t *>(R_alloc(len, sizeof(uint32_t)));
+  double prev = 0;
+  for (R_xlen_t i = 0; i < len; ++i) {
+    const double v = TYPEOF(x) == INTSXP
+        ? (INTEGER(x)[i] == NA_INTEGER ? NA_REAL : INTEGER(x)[i])
+        : REAL(x)[i];
+    if (!R_FINITE(v) || v != static_cast<double>(static_cast<int64_t>(v)) ||
+        v <= prev || v > n) {
+      Rf_error("%s must be strictly increasing indices between 1 and %u",
+               argname, n);
+    }
+    idx[i] = static_cast<uint32_t>(v) - 1;
+    prev = v;
+  }
+  return idx;
+}
+
+static double rpgen_seconds_since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+// Stream a pgenlib source into Rfmalloc's record-panel context. The source
+// declares the transfer representation; Rfmalloc owns packing, alignment,
+// and persistent layout.
+//
+// Reading and writing form a two-stage pipeline over a ring of panels.
+// Decoding threads each claim the next variant block, fill a free panel
+// from their own reader over the file's shared variant index, and queue it.
+// The calling thread drains the queue, writing each block in place through
+// an Rfmalloc writer handle, and hands the panel back. PGEN reads and
+// fmalloc page faults therefore overlap even with one decoder. With no free
+// panel a decoder waits, so memory stays at n_decoder + 2 panels, which
+// together fit kRpgenStreamRingBytes unless one variant alone does not.
+// Blocks land at fixed records, so the payload is the same for any thread
+// count. An error is reported for the first block that failed; blocks
+// claimed before it still finish, so which one that is does not depend on
+// timing either.
+// Returns list(payload, c(decode_seconds, write_seconds), qc), where
+// decode_seconds is summed over decoders.
+//
+// With `qc` TRUE the decoders also count each record's genotypes as they
+// decode it (rpgen_qc.h), and qc is rpgen_qc_result()'s list; otherwise it
+// is NULL.
+//
+// n_sample and n_variant are the file's counts. `samples` and `variants`
+// select from them: the reader decodes only the selected samples, and the
+// decoders seek from one selected variant to the next, so the cost follows
+// the selection rather than the file.
 SEXP RC_rpgen_stream_fmalloc(SEXP path_sexp, SEXP n_sample_sexp,
                              SEXP n_variant_sexp, SEXP kind_sexp,
-                             SEXP runtime_sexp, SEXP block_size_sexp) {
+                             SEXP runtime_sexp, SEXP block_size_sexp,
+                             SEXP threads_sexp, SEXP samples_sexp,
+                             SEXP variants_sexp, SEXP qc_sexp) {
   const char *path = rpgen_check_single_string(path_sexp, "path");
-  const uint32_t n_sample = rpgen_check_count(n_sample_sexp, "n_sample");
-  const uint32_t n_variant = rpgen_check_count(n_variant_sexp, "n_variant");
+  const uint32_t raw_sample_ct = rpgen_check_count(n_sample_sexp, "n_sample");
+  const uint32_t raw_variant_ct =
+      rpgen_check_count(n_variant_sexp, "n_variant");
   const int kind = Rf_asInteger(kind_sexp);
   const uint32_t block_size = rpgen_check_count(block_size_sexp, "block_size");
-  if (kind < 0 || kind > 3) {
-    Rf_error("kind must select hardcalls, dosages, phased haplotypes, or f64");
+  const uint32_t threads = rpgen_check_count(threads_sexp, "threads");
+  const uint32_t *sample_idx =
+      rpgen_check_selection(samples_sexp, raw_sample_ct, "samples");
+  const uint32_t *variant_idx =
+      rpgen_check_selection(variants_sexp, raw_variant_ct, "variants");
+  const uint32_t n_sample =
+      sample_idx ? (uint32_t)XLENGTH(samples_sexp) : raw_sample_ct;
+  const uint32_t n_variant =
+      variant_idx ? (uint32_t)XLENGTH(variants_sexp) : raw_variant_ct;
+  const bool qc = Rf_asLogical(qc_sexp) == 1;
+  if (kind < 0 || kind > 4) {
+    Rf_error("kind must select hardcalls, dosages, phased haplotypes, f64, "
+             "or 16-bit dosages");
   }
 
   const char *storage = kind == 0 ? "bed" :
                         kind == 1 ? "dosage" :
-                        kind == 2 ? "haplotype" : "f64";
+                        kind == 2 ? "haplotype" :
+                        kind == 3 ? "f64" : "dosage16";
+  const int source_type = kind == 0 ? RFMALLOC_BUFFER_PGEN_GENOVEC :
+                          kind == 2 ? RFMALLOC_BUFFER_PACKED_BITS :
+                          kind == 4 ? RFMALLOC_BUFFER_PGEN_DOSAGE16 :
+                          RFMALLOC_BUFFER_F64;
   const R_xlen_t n_item = kind == 2 ? (R_xlen_t)n_sample * 2 : n_sample;
   Rfmalloc_buffer_open_fun buffer_open = Rfmalloc_buffer_open_ptr();
-  Rfmalloc_buffer_write_fun buffer_write = Rfmalloc_buffer_write_ptr();
   Rfmalloc_buffer_finish_fun buffer_finish = Rfmalloc_buffer_finish_ptr();
   Rfmalloc_buffer_abort_fun buffer_abort = Rfmalloc_buffer_abort_ptr();
-  Rfmalloc_buffer_context *sink =
-      buffer_open(runtime_sexp, storage, n_item, n_variant);
-  if (!sink) {
-    Rf_error("failed to create Rfmalloc '%s' buffer", storage);
-  }
-
-  RpgenFullReader reader;
-  char errbuf[512];
-  if (rpgen_full_reader_open(path, kind == 1 || kind == 3, &reader,
-                             errbuf, sizeof(errbuf),
-                             n_sample, n_variant, kind == 2) != 0) {
-    buffer_abort(sink);
-    Rf_error("failed to open \"%s\": %s", path, errbuf);
-  }
-
-  const uint32_t panel_ncol = block_size < n_variant ? block_size : n_variant;
-  const size_t record_stride = kind == 0
-      ? (size_t)n_sample * sizeof(int32_t)
+  Rfmalloc_buffer_writer_open_fun writer_open =
+      Rfmalloc_buffer_writer_open_ptr();
+  Rfmalloc_buffer_writer_write_fun writer_write =
+      Rfmalloc_buffer_writer_write_ptr();
+  Rfmalloc_buffer_writer_close_fun writer_close =
+      Rfmalloc_buffer_writer_close_ptr();
+
+  const size_t record_stride = kind == 4
+      ? sizeof(Rfmalloc_buffer_dosage16)
+      : kind == 0
+      ? ((size_t)n_sample + 3) / 4
       : kind == 1 || kind == 3
           ? (size_t)n_sample * sizeof(double)
           : ((size_t)n_sample * 2 + 7) / 8;
-  if (record_stride > SIZE_MAX / panel_ncol) {
-    rpgen_full_reader_release(&reader);
-    buffer_abort(sink);
+  const size_t variant_bytes = kind == 4
+      ? record_stride + rpgen_dosage16_slot_bytes(n_sample)
+      : record_stride;
+
+  // Several blocks per thread even when block_size would make few, so
+  // threads that draw slow variants do not hold the others up.
+  uint32_t unit = block_size < n_variant ? block_size : n_variant;
+  if (threads > 1) {
+    const uint64_t share =
+        ((uint64_t)n_variant + 4ull * threads - 1) / (4ull * threads);
+    if (share < unit) {
+      unit = (uint32_t)share;
+    }
+  }
+  // Keep the ring of up to threads + 2 panels within its budget.
+  const uint64_t ring_unit =
+      kRpgenStreamRingBytes / ((uint64_t)variant_bytes * (threads + 2ull));
+  if (ring_unit < unit) {
+    unit = ring_unit > 0 ? (uint32_t)ring_unit : 1;
+  }
+  const uint32_t n_block = (uint32_t)(((uint64_t)n_variant + unit - 1) / unit);
+  const uint32_t n_thread = threads < n_block ? threads : n_block;
+
+  if (variant_bytes > SIZE_MAX / unit) {
     Rf_error("requested genotype panel is too large");
   }
-  void *panel = std::malloc(record_stride * panel_ncol);
-  if (!panel) {
-    rpgen_full_reader_release(&reader);
-    buffer_abort(sink);
-    Rf_error("failed to allocate genotype panel");
+  const size_t panel_bytes = variant_bytes * unit;
+
+  SEXP owner = PROTECT(R_MakeExternalPtr(nullptr, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(owner, rpgen_stream_finalizer, TRUE);
+  RpgenStreamState *st = new (std::nothrow) RpgenStreamState();
+  if (!st) {
+    Rf_error("failed to allocate %u genotype readers", n_thread);
+  }
+  R_SetExternalPtrAddr(owner, st);
+  st->abort = buffer_abort;
+  st->sink = buffer_open(runtime_sexp, storage, n_item, n_variant);
+  if (!st->sink) {
+    rpgen_stream_finalizer(owner);
+    Rf_error("failed to create Rfmalloc '%s' buffer", storage);
+  }
+  Rfmalloc_buffer_context *const sink = st->sink;
+
+  std::vector<RpgenStreamWorker> &workers = st->workers;
+  std::vector<RpgenStreamPanel> &panels = st->panels;
+  std::vector<uint32_t> &qc_counts = st->qc_counts;
+  try {
+    workers.resize(n_thread);
+    panels.resize(n_thread + 2, RpgenStreamPanel{nullptr, 0});
+    if (qc) {
+      qc_counts.resize((size_t)n_variant * 4);
+      for (RpgenStreamWorker &w : workers) {
+        rpgen_qc_counter_init(&w.qc, n_sample);
+      }
+    }
+    st->idle.reserve(panels.size());
+    st->queued.reserve(panels.size());
+    st->pool.reserve(n_thread);
+  } catch (...) {
+    rpgen_stream_finalizer(owner);
+    Rf_error("failed to allocate %u genotype readers", n_thread);
+  }
+  uint32_t *const qc_out = qc ? qc_counts.data() : nullptr;
+  for (RpgenStreamPanel &p : panels) {
+    p.data = std::malloc(panel_bytes);
+    if (!p.data) {
+      rpgen_stream_finalizer(owner);
+      Rf_error("failed to allocate genotype panel");
+    }
+  }
+  const bool with_dosage = kind == 1 || kind == 3 || kind == 4;
+  char errbuf[512];
+  for (; st->n_open < n_thread; ++st->n_open) {
+    RpgenStreamWorker &w = workers[st->n_open];
+    w.failed_block = UINT32_MAX;
+    w.status = 0;
+    w.decode_seconds = 0;
+    w.errbuf[0] = '\0';
+    const int rc = st->n_open == 0
+        ? rpgen_full_reader_open(path, with_dosage, &w.reader, errbuf,
+                                 sizeof(errbuf), raw_sample_ct,
+                                 raw_variant_ct, kind == 2, sample_idx,
+                                 n_sample)
+        : rpgen_full_reader_clone(path, &workers[0].reader, with_dosage,
+                                  kind == 2, &w.reader, errbuf,
+                                  sizeof(errbuf), sample_idx, n_sample);
+    if (rc != 0) {
+      rpgen_stream_finalizer(owner);
+      Rf_error("failed to open \"%s\": %s", path, errbuf);
+    }
   }
 
-  int rc = 0;
-  bool interrupted = false;
-  for (uint32_t first = 0; first < n_variant; first += panel_ncol) {
-    const uint32_t count =
-        panel_ncol < n_variant - first ? panel_ncol : n_variant - first;
-    if (kind == 0) {
-      rc = rpgen_full_reader_hardcalls(
-          &reader, first, count, static_cast<int32_t *>(panel), errbuf,
-          sizeof(errbuf));
-      if (rc == 0) {
-        rc = buffer_write(sink, first, count, RFMALLOC_BUFFER_I32, panel,
-                          record_stride);
+  // The ring: panels not in use, and decoded panels waiting for the writer.
+  std::mutex &lock = st->lock;
+  std::condition_variable &panel_freed = st->panel_freed;
+  std::condition_variable &panel_queued = st->panel_queued;
+  std::vector<RpgenStreamPanel *> &idle = st->idle;
+  std::vector<RpgenStreamPanel *> &queued = st->queued;
+  for (RpgenStreamPanel &p : panels) {
+    idle.push_back(&p);
+  }
+  uint32_t next_block = 0;
+  uint32_t n_decoding = 0;
+  bool stop = false;
+
+  auto decode = [&](RpgenStreamWorker *w) {
+    for (;;) {
+      RpgenStreamPanel *p;
+      uint32_t b;
+      {
+        std::unique_lock<std::mutex> hold(lock);
+        panel_freed.wait(hold, [&] { return stop || !idle.empty(); });
+        if (stop || next_block == n_block) {
+          break;
+        }
+        p = idle.back();
+        idle.pop_back();
+        b = next_block++;
       }
-    } else if (kind == 1 || kind == 3) {
-      rc = rpgen_full_reader_dosages(
-          &reader, first, count, static_cast<double *>(panel), errbuf,
-          sizeof(errbuf));
-      if (rc == 0) {
-        rc = buffer_write(sink, first, count, RFMALLOC_BUFFER_F64, panel,
-                          record_stride);
-      }
-    } else {
-      rc = rpgen_full_reader_haplotypes(
-          &reader, first, count, static_cast<uint8_t *>(panel), record_stride,
-          errbuf, sizeof(errbuf));
-      if (rc == 0) {
-        rc = buffer_write(sink, first, count, RFMALLOC_BUFFER_PACKED_BITS,
-                          panel, record_stride);
+      const uint32_t first = b * unit;
+      const uint32_t count =
+          unit < n_variant - first ? unit : n_variant - first;
+      const std::chrono::steady_clock::time_point t0 =
+          std::chrono::steady_clock::now();
+      const int status = rpgen_stream_decode(w, kind, first, count, unit,
+                                             record_stride, variant_idx,
+                                             p->data, qc_out);
+      w->decode_seconds += rpgen_seconds_since(t0);
+      std::lock_guard<std::mutex> hold(lock);
+      if (status != 0) {
+        w->failed_block = b;
+        w->status = status;
+        stop = true;
+        idle.push_back(p);
+        panel_freed.notify_all();
+        break;
       }
+      p->block = b;
+      queued.push_back(p);
+      panel_queued.notify_one();
     }
+    std::lock_guard<std::mutex> hold(lock);
+    --n_decoding;
+    panel_queued.notify_one();
+  };
+
+  RpgenStreamWorker write_failure;
+  write_failure.failed_block = UINT32_MAX;
+  write_failure.status = 0;
+  write_failure.errbuf[0] = '\0';
+  double write_seconds = 0;
+  auto write_panel = [&](RpgenStreamPanel *p) {
+    const uint32_t first = p->block * unit;
+    const uint32_t count = unit < n_variant - first ? unit : n_variant - first;
+    const std::chrono::steady_clock::time_point t0 =
+        std::chrono::steady_clock::now();
+    Rfmalloc_buffer_writer *writer = writer_open(sink, first, count);
+    const int rc = writer ? writer_write(writer, first, count, source_type,
+                                         p->data, record_stride)
+                          : -1;
+    writer_close(writer);
+    write_seconds += rpgen_seconds_since(t0);
     if (rc != 0) {
+      write_failure.failed_block = p->block;
+      write_failure.status = 2;
+    }
+    return rc == 0;
+  };
+
+  // The calling thread is the writer, and the only one that checks for
+  // interrupts.
+  std::vector<std::thread> &pool = st->pool;
+  n_decoding = n_thread;
+  for (uint32_t t = 0; t < n_thread; ++t) {
+    try {
+      pool.emplace_back(decode, &workers[t]);
+    } catch (...) {
+      std::lock_guard<std::mutex> hold(lock);
+      n_decoding -= n_thread - t;  // fewer decoders; all blocks still run
       break;
     }
+  }
+  bool interrupted = false;
+  if (pool.empty()) {
+    // No thread could be started: decode and write in turn.
+    RpgenStreamPanel *p = &panels[0];
+    for (p->block = 0; p->block < n_block; ++p->block) {
+      const uint32_t first = p->block * unit;
+      const uint32_t count =
+          unit < n_variant - first ? unit : n_variant - first;
+      RpgenStreamWorker *w = &workers[0];
+      const std::chrono::steady_clock::time_point t0 =
+          std::chrono::steady_clock::now();
+      w->status = rpgen_stream_decode(w, kind, first, count, unit,
+                                      record_stride, variant_idx, p->data,
+                                      qc_out);
+      w->decode_seconds += rpgen_seconds_since(t0);
+      if (w->status != 0) {
+        w->failed_block = p->block;
+        break;
+      }
+      if (!write_panel(p)) {
+        break;
+      }
+      if (R_ToplevelExec(rpgen_interrupt_check, nullptr) == FALSE) {
+        interrupted = true;
+        break;
+      }
+    }
+  }
+  while (!pool.empty()) {
+    RpgenStreamPanel *p = nullptr;
+    {
+      std::unique_lock<std::mutex> hold(lock);
+      panel_queued.wait_for(hold, std::chrono::milliseconds(100), [&] {
+        return !queued.empty() || n_decoding == 0;
+      });
+      if (!queued.empty()) {
+        p = queued.back();
+        queued.pop_back();
+      } else if (n_decoding == 0 || stop) {
+        break;
+      }
+    }
+    if (p) {
+      const bool ok = write_panel(p);
+      std::lock_guard<std::mutex> hold(lock);
+      stop = stop || !ok;
+      idle.push_back(p);
+      panel_freed.notify_all();
+    }
     if (R_ToplevelExec(rpgen_interrupt_check, nullptr) == FALSE) {
       interrupted = true;
-      break;
+      std::lock_guard<std::mutex> hold(lock);
+      stop = true;
+      panel_freed.notify_all();
     }
   }
+  for (std::thread &th : pool) {
+    th.join();
+  }
 
-  std::free(panel);
-  rpgen_full_reader_release(&reader);
-  if (interrupted) {
-    buffer_abort(sink);
+  const RpgenStreamWorker *failed = nullptr;
+  if (write_failure.status != 0) {
+    failed = &write_failure;
+  }
+  for (const RpgenStreamWorker &w : workers) {
+    if (w.status != 0 && (!failed || w.failed_block < failed->failed_block)) {
+      failed = &w;
+    }
+  }
+  int status = 0;
+  if (failed) {
+    status = failed->status;
+    snprintf(errbuf, sizeof(errbuf), "%s", failed->errbuf);
+  }
+  double decode_seconds = 0;
+  for (const RpgenStreamWorker &w : workers) {
+    decode_seconds += w.decode_seconds;
+  }
+  if (interrupted && !failed) {
+    rpgen_stream_finalizer(owner);
     Rf_error("genotype import interrupted");
   }
-  if (rc != 0) {
-    buffer_abort(sink);
-    if (errbuf[0]) {
+  if (status != 0) {
+    rpgen_stream_finalizer(owner);
+    if (status == 1 && errbuf[0]) {
       Rf_error("failed while reading \"%s\": %s", path, errbuf);
     }
     Rf_error("Rfmalloc rejected a genotype panel from \"%s\"", path);
   }
 
+  // finish consumes the context unless it returns R_NilValue, and may
+  // raise an R error once it has.
+  st->sink = nullptr;
   SEXP payload = PROTECT(buffer_finish(sink));
   if (payload == R_NilValue) {
-    UNPROTECT(1);
+    buffer_abort(sink);
+    rpgen_stream_finalizer(owner);
     Rf_error("failed to finish Rfmalloc '%s' buffer", storage);
   }
-  UNPROTECT(1);
-  return payload;
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(out, 0, payload);
+  SEXP timing = Rf_allocVector(REALSXP, 2);
+  SET_VECTOR_ELT(out, 1, timing);
+  REAL(timing)[0] = decode_seconds;
+  REAL(timing)[1] = write_seconds;
+  if (qc) {
+    for (size_t t = 1; t < workers.size(); ++t) {
+      rpgen_qc_merge(&workers[0].qc, &workers[t].qc);
+    }
+    SET_VECTOR_ELT(out, 2, rpgen_qc_result(n_variant, qc_counts.data(),
+                                           &workers[0].qc));
+  }
+  rpgen_stream_finalizer(owner);
+  UNPROTECT(3);
+  return out;
 }
 
 SEXP RC_rpgen_read_bed_hardcalls(SEXP bed_sexp, SEXP bim_sexp,
@@ -1088,15 +2244,149 @@ SEXP RC_rpgen_read_bed_hardcalls(SEXP bed_sexp, SEXP bim_sexp,
   return result;
 }
 
+// -- lazy PGEN tensors ---------------------------------------------------------
+
+SEXP RC_rpgen_register_codec(void) {
+  // -2: already registered by an earlier load in this session.
+  const int rc =
+      Rfmalloc_register_tensor_codec("pgen", 1, 1, rpgen_tensor_decode);
+  if ((rc != 0 && rc != -2) ||
+      Rfmalloc_register_tensor_codec_extent("pgen", rpgen_tensor_extent) != 0 ||
+      Rfmalloc_register_tensor_codec_error("pgen", rpgen_tensor_error) != 0) {
+    Rf_error("failed to register the 'pgen' tensor codec");
+  }
+  return R_NilValue;
+}
+
+// From .onUnload: drops the "pgen" codec, whose functions are about to be
+// unmapped, and closes every pooled file and cached variant. No decode can be
+// running, since decodes only run inside R calls.
+SEXP RC_rpgen_unload(void) {
+  Rfmalloc_unregister_tensor_codec("pgen");
+  RpgenTensorPool &pool = rpgen_tensor_pool;
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  for (auto &f : pool.files) {
+    rpgen_tensor_file_close(pool, f.get());
+  }
+  pool.files.clear();
+  pool.cache.clear();
+  pool.lru.clear();
+  pool.cache_bytes = 0;
+  pool.errors.clear();
+  return R_NilValue;
+}
+
+// With payload = NULL, the bytes a "pgen" payload for this selection takes.
+// Otherwise checks that the file opens with these counts and selection, then
+// fills payload, an fmalloc raw vector at least that long, and returns it.
+SEXP RC_rpgen_tensor_payload(SEXP path_sexp, SEXP n_sample_sexp,
+                             SEXP n_variant_sexp, SEXP kind_sexp,
+                             SEXP samples_sexp, SEXP variants_sexp,
+                             SEXP threads_sexp, SEXP payload) {
+  const char *path = rpgen_check_single_string(path_sexp, "path");
+  const uint32_t raw_sample_ct = rpgen_check_count(n_sample_sexp, "n_sample");
+  const uint32_t raw_variant_ct =
+      rpgen_check_count(n_variant_sexp, "n_variant");
+  const int kind = Rf_asInteger(kind_sexp);
+  if (kind != 0 && kind != 1) {
+    Rf_error("kind must be 0 (hardcalls) or 1 (dosages)");
+  }
+  const uint32_t *sample_idx =
+      rpgen_check_selection(samples_sexp, raw_sample_ct, "samples");
+  const uint32_t *variant_idx =
+      rpgen_check_selection(variants_sexp, raw_variant_ct, "variants");
+  const uint32_t threads = rpgen_check_count(threads_sexp, "threads");
+  const size_t path_len = strlen(path);
+  if (path_len == 0 || path_len >= UINT32_MAX) {
+    Rf_error("path must be a non-empty string");
+  }
+
+  RpgenTensorHeader h;
+  std::memcpy(h.magic, kRpgenTensorMagic, sizeof(h.magic));
+  h.kind = static_cast<uint32_t>(kind);
+  h.flags = (sample_idx ? kRpgenTensorSamples : 0) |
+            (variant_idx ? kRpgenTensorVariants : 0);
+  h.raw_sample_ct = raw_sample_ct;
+  h.raw_variant_ct = raw_variant_ct;
+  h.n_sample = sample_idx ? static_cast<uint32_t>(XLENGTH(samples_sexp))
+                          : raw_sample_ct;
+  h.n_variant = variant_idx ? static_cast<uint32_t>(XLENGTH(variants_sexp))
+                            : raw_variant_ct;
+  h.threads = threads;
+  h.path_bytes = static_cast<uint32_t>(path_len + 1);
+  const size_t bytes = rpgen_tensor_payload_bytes(h.path_bytes, h.flags,
+                                                  h.n_sample, h.n_variant);
+  if (payload == R_NilValue) {
+    return Rf_ScalarReal(static_cast<double>(bytes));
+  }
+  if (TYPEOF(payload) != RAWSXP ||
+      static_cast<size_t>(XLENGTH(payload)) < bytes) {
+    Rf_error("payload must be a raw vector of at least %.0f bytes",
+             static_cast<double>(bytes));
+  }
+
+  // Fail here, not at the first decode, on a file these counts do not fit.
+  RpgenFullReader r;
+  char errbuf[512];
+  if (rpgen_full_reader_open(path, kind == 1, &r, errbuf, sizeof(errbuf),
+                             raw_sample_ct, raw_variant_ct, false, sample_idx,
+                             h.n_sample) != 0) {
+    Rf_error("failed to open \"%s\": %s", path, errbuf);
+  }
+  rpgen_full_reader_release(&r);
+
+  uint8_t *dst = RAW(payload);
+  std::memset(dst, 0, bytes);
+  std::memcpy(dst, &h, sizeof(h));
+  std::memcpy(dst + sizeof(h), path, path_len);
+  uint8_t *idx = dst + sizeof(h) + ((h.path_bytes + 3u) & ~3u);
+  if (sample_idx) {
+    std::memcpy(idx, sample_idx, (size_t)h.n_sample * sizeof(uint32_t));
+    idx += (size_t)h.n_sample * sizeof(uint32_t);
+  }
+  if (variant_idx) {
+    std::memcpy(idx, variant_idx, (size_t)h.n_variant * sizeof(uint32_t));
+  }
+  return payload;
+}
+
+// Sets the decoded-variant cache's limit in bytes when limit is not NULL,
+// dropping the oldest variants to fit, and returns c(limit, used).
+SEXP RC_rpgen_tensor_cache(SEXP limit_sexp) {
+  size_t limit = 0;
+  if (limit_sexp != R_NilValue) {
+    const double value = Rf_asReal(limit_sexp);
+    if (!R_FINITE(value) || value < 0) {
+      Rf_error("size must be a non-negative number of bytes");
+    }
+    limit = value >= static_cast<double>(SIZE_MAX)
+                ? SIZE_MAX
+                : static_cast<size_t>(value);
+  }
+  SEXP ans = PROTECT(Rf_allocVector(REALSXP, 2));
+  {
+    RpgenTensorPool &pool = rpgen_tensor_pool;
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (limit_sexp != R_NilValue) {
+      pool.cache_limit = limit;
+      rpgen_tensor_cache_trim(pool, limit);
+    }
+    REAL(ans)[0] = static_cast<double>(pool.cache_limit);
+    REAL(ans)[1] = static_cast<double>(pool.cache_bytes);
+  }
+  UNPROTECT(1);
+  return ans;
+}
+
 // Implemented in src/rpgen_import.cpp; declared here only
 // so they can be listed in this file's shared CallEntries/register_c_callables
 // tables, the single registration point for all of Rpgen's entry points.
 int Rpgen_import_vcf(const char *vcf_path, const char *out_pgen_path,
                       char *errbuf, size_t errbuf_len);
-SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp);
+SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp, SEXP threads_sexp);
 int Rpgen_import_bcf(const char *bcf_path, const char *out_pgen_path,
                       char *errbuf, size_t errbuf_len);
-SEXP RC_rpgen_import_bcf(SEXP bcf_sexp, SEXP out_sexp);
+SEXP RC_rpgen_import_bcf(SEXP bcf_sexp, SEXP out_sexp, SEXP threads_sexp);
 int Rpgen_import_gen(const char *gen_path, const char *sample_path,
                       const char *out_pgen_path, char *errbuf,
                       size_t errbuf_len);
@@ -1104,7 +2394,8 @@ SEXP RC_rpgen_import_gen(SEXP gen_sexp, SEXP sample_sexp, SEXP out_sexp);
 int Rpgen_import_bgen(const char *bgen_path, const char *sample_path,
                        const char *out_pgen_path, char *errbuf,
                        size_t errbuf_len);
-SEXP RC_rpgen_import_bgen(SEXP bgen_sexp, SEXP sample_sexp, SEXP out_sexp);
+SEXP RC_rpgen_import_bgen(SEXP bgen_sexp, SEXP sample_sexp, SEXP out_sexp,
+                          SEXP threads_sexp);
 int Rpgen_import_haps(const char *haps_path, const char *legend_path,
                        const char *sample_path, const char *chr,
                        const char *out_pgen_path, char *errbuf,
@@ -1131,30 +2422,51 @@ int Rpgen_import_eigenstrat(const char *geno_path, const char *ind_path,
                              size_t errbuf_len);
 SEXP RC_rpgen_import_eigenstrat(SEXP geno_sexp, SEXP ind_sexp,
                                  SEXP snp_sexp, SEXP out_sexp);
+SEXP RC_rpgen_bgzip(SEXP path_sexp, SEXP out_sexp, SEXP threads_sexp);
 SEXP RC_rpgen_direct_sink_begin(SEXP kind_sexp, SEXP runtime_sexp,
-                                SEXP variant_ct_hint_sexp);
+                                SEXP variant_ct_hint_sexp, SEXP qc_sexp);
 SEXP RC_rpgen_direct_sink_finish(void);
 SEXP RC_rpgen_direct_sink_abort(void);
+// Implemented in src/rpgen_position_index.cpp.
+SEXP RC_rpgen_position_index(SEXP codes_sexp, SEXP pos_sexp, SEXP chroms_sexp,
+                             SEXP payload);
+SEXP RC_rpgen_position_info(SEXP index);
+SEXP RC_rpgen_position_region(SEXP index, SEXP chrom_sexp, SEXP start_sexp,
+                              SEXP end_sexp);
+SEXP RC_rpgen_position_nearest(SEXP index, SEXP chrom_sexp, SEXP pos_sexp);
+SEXP RC_rpgen_position_window(SEXP index, SEXP chrom_sexp, SEXP start_sexp,
+                              SEXP end_sexp);
 
 static const R_CallMethodDef CallEntries[] = {
     {"RC_rpgen_info", (DL_FUNC)&RC_rpgen_info, 1},
     {"RC_rpgen_read_hardcalls", (DL_FUNC)&RC_rpgen_read_hardcalls, 2},
     {"RC_rpgen_read_dosages", (DL_FUNC)&RC_rpgen_read_dosages, 2},
     {"RC_rpgen_read_bed_hardcalls", (DL_FUNC)&RC_rpgen_read_bed_hardcalls, 3},
-    {"RC_rpgen_stream_fmalloc", (DL_FUNC)&RC_rpgen_stream_fmalloc, 6},
-    {"RC_rpgen_import_vcf", (DL_FUNC)&RC_rpgen_import_vcf, 2},
-    {"RC_rpgen_import_bcf", (DL_FUNC)&RC_rpgen_import_bcf, 2},
+    {"RC_rpgen_stream_fmalloc", (DL_FUNC)&RC_rpgen_stream_fmalloc, 10},
+    {"RC_rpgen_read_variants", (DL_FUNC)&RC_rpgen_read_variants, 1},
+    {"RC_rpgen_register_codec", (DL_FUNC)&RC_rpgen_register_codec, 0},
+    {"RC_rpgen_unload", (DL_FUNC)&RC_rpgen_unload, 0},
+    {"RC_rpgen_tensor_payload", (DL_FUNC)&RC_rpgen_tensor_payload, 8},
+    {"RC_rpgen_tensor_cache", (DL_FUNC)&RC_rpgen_tensor_cache, 1},
+    {"RC_rpgen_import_vcf", (DL_FUNC)&RC_rpgen_import_vcf, 3},
+    {"RC_rpgen_import_bcf", (DL_FUNC)&RC_rpgen_import_bcf, 3},
     {"RC_rpgen_import_gen", (DL_FUNC)&RC_rpgen_import_gen, 3},
-    {"RC_rpgen_import_bgen", (DL_FUNC)&RC_rpgen_import_bgen, 3},
+    {"RC_rpgen_import_bgen", (DL_FUNC)&RC_rpgen_import_bgen, 4},
     {"RC_rpgen_import_haps", (DL_FUNC)&RC_rpgen_import_haps, 5},
     {"RC_rpgen_import_plink1_dosage",
      (DL_FUNC)&RC_rpgen_import_plink1_dosage, 4},
     {"RC_rpgen_import_ped", (DL_FUNC)&RC_rpgen_import_ped, 3},
     {"RC_rpgen_import_tped", (DL_FUNC)&RC_rpgen_import_tped, 3},
     {"RC_rpgen_import_eigenstrat", (DL_FUNC)&RC_rpgen_import_eigenstrat, 4},
-    {"RC_rpgen_direct_sink_begin", (DL_FUNC)&RC_rpgen_direct_sink_begin, 3},
+    {"RC_rpgen_bgzip", (DL_FUNC)&RC_rpgen_bgzip, 3},
+    {"RC_rpgen_direct_sink_begin", (DL_FUNC)&RC_rpgen_direct_sink_begin, 4},
     {"RC_rpgen_direct_sink_finish", (DL_FUNC)&RC_rpgen_direct_sink_finish, 0},
     {"RC_rpgen_direct_sink_abort", (DL_FUNC)&RC_rpgen_direct_sink_abort, 0},
+    {"RC_rpgen_position_index", (DL_FUNC)&RC_rpgen_position_index, 4},
+    {"RC_rpgen_position_info", (DL_FUNC)&RC_rpgen_position_info, 1},
+    {"RC_rpgen_position_region", (DL_FUNC)&RC_rpgen_position_region, 4},
+    {"RC_rpgen_position_nearest", (DL_FUNC)&RC_rpgen_position_nearest, 3},
+    {"RC_rpgen_position_window", (DL_FUNC)&RC_rpgen_position_window, 4},
     {NULL, NULL, 0}};
 
 static void register_c_callables(DllInfo *dll) {
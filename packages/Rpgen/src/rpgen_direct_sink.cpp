@@ -14,6 +14,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <new>
 
 #include <R.h>
 #include <Rinternals.h>
@@ -22,6 +23,7 @@
 #include <Rfmalloc.h>
 
 #include "rpgen_direct_sink.h"
+#include "rpgen_qc.h"
 
 namespace {
 
@@ -29,7 +31,8 @@ enum rpgen_direct_kind {
   RPGEN_DIRECT_HARDCALL = 0,
   RPGEN_DIRECT_DOSAGE = 1,
   RPGEN_DIRECT_HAPLOTYPE = 2,
-  RPGEN_DIRECT_F64 = 3
+  RPGEN_DIRECT_F64 = 3,
+  RPGEN_DIRECT_DOSAGE16 = 4
 };
 
 struct rpgen_direct_state {
@@ -51,6 +54,9 @@ struct rpgen_direct_state {
   uint32_t variant_ct;
   uint32_t writer_variant_limit;
   uint32_t variant_ct_hint;
+  int qc;                   // count genotypes for rpgen_ingest(qc = TRUE)
+  RpgenQcCounter *qc_counter;
+  uint32_t *qc_counts;      // 4 per destination variant
   char error[256];
 };
 
@@ -86,6 +92,8 @@ rpgen_direct_release(int abort_buffer)
   direct_state.row = nullptr;
   free(direct_state.genovec_scratch);
   direct_state.genovec_scratch = nullptr;
+  delete direct_state.qc_counter;
+  free(direct_state.qc_counts);
   if (direct_state.runtime && direct_state.runtime != R_NilValue) {
     R_ReleaseObject(direct_state.runtime);
   }
@@ -125,18 +133,6 @@ rpgen_direct_bit(const uintptr_t *bits, uint32_t bit_idx)
       ((bits[bit_idx / bits_per_word] >> (bit_idx % bits_per_word)) & 1);
 }
 
-static int
-rpgen_direct_fill_hardcalls(const uintptr_t *genovec)
-{
-  int32_t *out = static_cast<int32_t *>(direct_state.row);
-  for (uint32_t sample_idx = 0; sample_idx != direct_state.sample_ct;
-       ++sample_idx) {
-    const uint32_t geno = rpgen_direct_geno(genovec, sample_idx);
-    out[sample_idx] = geno == 3 ? NA_INTEGER : static_cast<int32_t>(geno);
-  }
-  return 0;
-}
-
 static int
 rpgen_direct_fill_dosages(const uintptr_t *genovec,
     const uintptr_t *dosage_present, const uint16_t *dosage_main,
@@ -256,12 +252,10 @@ rpgen_direct_sink_open(uint32_t variant_ct, uint32_t sample_ct)
   size_t row_bytes;
   switch (direct_state.kind) {
   case RPGEN_DIRECT_HARDCALL:
+    // The genovec goes to Rfmalloc as is; the row only sizes the record.
     storage = "bed";
     n_item = static_cast<R_xlen_t>(sample_ct);
-    if (rpgen_size_mul(sample_ct, sizeof(int32_t), &row_bytes)) {
-      rpgen_direct_error("hardcall record is too large");
-      return -1;
-    }
+    row_bytes = (static_cast<size_t>(sample_ct) + 3) / 4;
     break;
   case RPGEN_DIRECT_DOSAGE:
   case RPGEN_DIRECT_F64:
@@ -272,6 +266,11 @@ rpgen_direct_sink_open(uint32_t variant_ct, uint32_t sample_ct)
       return -1;
     }
     break;
+  case RPGEN_DIRECT_DOSAGE16:
+    storage = "dosage16";
+    n_item = static_cast<R_xlen_t>(sample_ct);
+    row_bytes = sizeof(Rfmalloc_buffer_dosage16);
+    break;
   case RPGEN_DIRECT_HAPLOTYPE:
     storage = "haplotype";
     if (static_cast<uint64_t>(sample_ct) * 2 >
@@ -338,6 +337,32 @@ rpgen_direct_sink_open(uint32_t variant_ct, uint32_t sample_ct)
     return -1;
   }
 
+  if (direct_state.qc) {
+    direct_state.qc_counter = new (std::nothrow) RpgenQcCounter;
+    direct_state.qc_counts = static_cast<uint32_t *>(
+        calloc(static_cast<size_t>(destination_variant_ct) * 4,
+            sizeof(uint32_t)));
+    bool sized = direct_state.qc_counter && direct_state.qc_counts;
+    if (sized) {
+      try {
+        rpgen_qc_counter_init(direct_state.qc_counter, sample_ct);
+      } catch (...) {
+        sized = false;
+      }
+    }
+    if (!sized) {
+      direct_state.buffer_abort(call.result);
+      free(direct_state.row);
+      direct_state.row = nullptr;
+      direct_state.row_bytes = 0;
+      free(direct_state.genovec_scratch);
+      direct_state.genovec_scratch = nullptr;
+      direct_state.genovec_word_ct = 0;
+      rpgen_direct_error("failed to allocate genotype QC counts");
+      return -1;
+    }
+  }
+
   direct_state.buffer = call.result;
   direct_state.sample_ct = sample_ct;
   direct_state.variant_ct = destination_variant_ct;
@@ -404,13 +429,27 @@ rpgen_direct_sink_append(uint32_t variant_idx, uint32_t sample_ct,
 
   int source_type;
   int rc;
+  const void *record = direct_state.row;
   if (direct_state.kind == RPGEN_DIRECT_HARDCALL) {
-    source_type = RFMALLOC_BUFFER_I32;
-    rc = rpgen_direct_fill_hardcalls(genovec);
+    // PLINK 2's genovec is a packed hardcall record Rfmalloc recodes itself.
+    source_type = RFMALLOC_BUFFER_PGEN_GENOVEC;
+    record = genovec;
+    rc = 0;
   } else if (direct_state.kind == RPGEN_DIRECT_HAPLOTYPE) {
     source_type = RFMALLOC_BUFFER_PACKED_BITS;
     rc = rpgen_direct_fill_haplotypes(genovec, phase_supplied, phasepresent,
         phaseinfo, variant_idx);
+  } else if (direct_state.kind == RPGEN_DIRECT_DOSAGE16) {
+    // PLINK 2's record is already the storage format: pass it through and
+    // let Rfmalloc validate it.
+    source_type = RFMALLOC_BUFFER_PGEN_DOSAGE16;
+    Rfmalloc_buffer_dosage16 *rec =
+        static_cast<Rfmalloc_buffer_dosage16 *>(direct_state.row);
+    rec->genovec = genovec;
+    rec->dosage_present = dosage_present;
+    rec->dosage_main = dosage_main;
+    rec->dosage_ct = dosage_ct;
+    rc = 0;
   } else {
     source_type = RFMALLOC_BUFFER_F64;
     rc = rpgen_direct_fill_dosages(genovec, dosage_present, dosage_main,
@@ -420,10 +459,14 @@ rpgen_direct_sink_append(uint32_t variant_idx, uint32_t sample_ct,
     return -1;
   }
   if (direct_state.buffer_write(direct_state.buffer, variant_idx, 1,
-      source_type, direct_state.row, direct_state.row_bytes) != 0) {
+      source_type, record, direct_state.row_bytes) != 0) {
     rpgen_direct_error("Rfmalloc rejected a direct genotype record");
     return -1;
   }
+  if (direct_state.qc) {
+    rpgen_qc_add(direct_state.qc_counter, genovec,
+        direct_state.qc_counts + static_cast<size_t>(variant_idx) * 4);
+  }
   return 0;
 }
 
@@ -443,15 +486,16 @@ rpgen_direct_sink_writer_finish(uint32_t variant_ct,
 
 extern "C" SEXP
 RC_rpgen_direct_sink_begin(SEXP kind_sexp, SEXP runtime_sexp,
-    SEXP variant_ct_hint_sexp)
+    SEXP variant_ct_hint_sexp, SEXP qc_sexp)
 {
   const int kind = Rf_asInteger(kind_sexp);
+  const int qc = Rf_asLogical(qc_sexp) == 1;
   const double variant_ct_hint = Rf_asReal(variant_ct_hint_sexp);
   Rfmalloc_buffer_open_fun buffer_open;
   Rfmalloc_buffer_write_fun buffer_write;
   Rfmalloc_buffer_finish_fun buffer_finish;
   Rfmalloc_buffer_abort_fun buffer_abort;
-  if (kind < RPGEN_DIRECT_HARDCALL || kind > RPGEN_DIRECT_F64) {
+  if (kind < RPGEN_DIRECT_HARDCALL || kind > RPGEN_DIRECT_DOSAGE16) {
     Rf_error("invalid direct genotype destination");
   }
   if (direct_state.active) {
@@ -474,6 +518,7 @@ RC_rpgen_direct_sink_begin(SEXP kind_sexp, SEXP runtime_sexp,
   direct_state.active = 1;
   direct_state.kind = kind;
   direct_state.variant_ct_hint = static_cast<uint32_t>(variant_ct_hint);
+  direct_state.qc = qc;
   direct_state.runtime = runtime_sexp;
   direct_state.buffer_open = buffer_open;
   direct_state.buffer_write = buffer_write;
@@ -500,7 +545,7 @@ RC_rpgen_direct_sink_finish(void)
   Rfmalloc_buffer_context *buffer = direct_state.buffer;
   direct_state.buffer = nullptr;
 
-  SEXP ans = PROTECT(Rf_allocVector(VECSXP, 3));
+  SEXP ans = PROTECT(Rf_allocVector(VECSXP, 4));
   SEXP payload = PROTECT(direct_state.buffer_finish(buffer));
   if (payload == R_NilValue) {
     UNPROTECT(2);
@@ -510,10 +555,15 @@ RC_rpgen_direct_sink_finish(void)
   SET_VECTOR_ELT(ans, 0, payload);
   SET_VECTOR_ELT(ans, 1, Rf_ScalarReal(static_cast<double>(sample_ct)));
   SET_VECTOR_ELT(ans, 2, Rf_ScalarReal(static_cast<double>(variant_ct)));
-  SEXP names = PROTECT(Rf_allocVector(STRSXP, 3));
+  if (direct_state.qc) {
+    SET_VECTOR_ELT(ans, 3, rpgen_qc_result(variant_ct, direct_state.qc_counts,
+        direct_state.qc_counter));
+  }
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, 4));
   SET_STRING_ELT(names, 0, Rf_mkChar("payload"));
   SET_STRING_ELT(names, 1, Rf_mkChar("n_sample"));
   SET_STRING_ELT(names, 2, Rf_mkChar("n_variant"));
+  SET_STRING_ELT(names, 3, Rf_mkChar("qc"));
   Rf_setAttrib(ans, R_NamesSymbol, names);
 
   rpgen_direct_release(0);
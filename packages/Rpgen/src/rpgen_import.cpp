@@ -40,6 +40,7 @@
 #include "plink2_common.h"   // InitChrInfoHuman(), CleanupChrInfo()
 #include "plink2_import.h"   // VcfToPgen()
 #include "plink2_import_legacy.h"  // PedmapToPgen(), TpedToPgen()
+#include "include/plink2_bgzf.h"  // BgzfCompressStream, for RC_rpgen_bgzip()
 
 #include <csetjmp>
 
@@ -64,6 +65,19 @@ namespace {
 // why it is not reentrant.
 constexpr uintptr_t kRpgenImportArenaMib = 512;
 
+// VCF, BCF and BGEN imports take a thread count, passed to the importer as
+// max_thread_ct. Those importers decompress BGZF blocks on their own threads
+// (BCF and BGZF-compressed VCF through plink2_bgzf's multithreaded reader,
+// BGEN records through one libdeflate/zstd decompressor per thread) and parse
+// records on worker threads into a double buffer. Only the calling thread
+// appends to the .pgen writer, in file order, so the direct sink (see
+// rpgen_direct_sink.h) still runs on R's evaluator thread. Workers never
+// touch the R API, and their only exit() calls sit on plink2's own
+// "multiallelic dosage: shouldn't be possible" branches, which the importers'
+// first pass rules out. plink2 caps the count at kMaxThreads; the importers
+// also shrink it to what the arena can buffer.
+constexpr uint32_t kRpgenImportMaxThreads = plink2::kMaxThreads;
+
 // Splits `out_pgen_path` (which must end in ".pgen") into the
 // (outname, outname_end) pair VcfToPgen() expects: outname_end is where it
 // appends its own suffixes (".pgen", ".pvar"/".pvar.zst", ".psam", each via
@@ -124,7 +138,7 @@ const char *rpgen_reterr_str(plink2::PglErr reterr) {
 // allocations) is released exactly once at `cleanup`, regardless of which
 // step failed.
 int rpgen_import_vcf(const char *vcf_path, const char *out_pgen_path,
-                      char *errbuf, size_t errbuf_len) {
+                      uint32_t thread_ct, char *errbuf, size_t errbuf_len) {
   if (errbuf_len > 0) {
     errbuf[0] = '\0';
   }
@@ -225,7 +239,7 @@ int rpgen_import_vcf(const char *vcf_path, const char *out_pgen_path,
         /*fam_cols=*/plink2::kfFamCol13456,             // plink2.cc default (all .psam/.fam columns)
         /*import_max_allele_ct=*/0x7ffffffe,            // plink2.cc default (effectively unlimited)
         /*overlong_varids_mode=*/plink2::kImportOverlongVarIds0,  // plink2.cc default
-        /*max_thread_ct=*/1,  // conservative single-threaded default for a library call
+        /*max_thread_ct=*/thread_ct,  // see kRpgenImportMaxThreads
         outname, outname_end, &chr_info, &pgen_generated, &psam_generated);
     if (reterr != plink2::kPglRetSuccess) {
       snprintf(errbuf, errbuf_len, "VcfToPgen(\"%s\") failed: %s (code %d)",
@@ -265,7 +279,7 @@ cleanup:
 // function's comment for the arena/jmp_buf/goto-cleanup mechanics, which are
 // identical here too.
 int rpgen_import_bcf(const char *bcf_path, const char *out_pgen_path,
-                      char *errbuf, size_t errbuf_len) {
+                      uint32_t thread_ct, char *errbuf, size_t errbuf_len) {
   if (errbuf_len > 0) {
     errbuf[0] = '\0';
   }
@@ -342,7 +356,7 @@ int rpgen_import_bcf(const char *bcf_path, const char *out_pgen_path,
         /*fam_cols=*/plink2::kfFamCol13456,             // plink2.cc default (all .psam/.fam columns)
         /*import_max_allele_ct=*/0x7ffffffe,            // plink2.cc default (effectively unlimited)
         /*overlong_varids_mode=*/plink2::kImportOverlongVarIds0,  // plink2.cc default
-        /*max_thread_ct=*/1,  // conservative single-threaded default for a library call
+        /*max_thread_ct=*/thread_ct,  // see kRpgenImportMaxThreads
         outname, outname_end, &chr_info, &pgen_generated, &psam_generated);
     if (reterr != plink2::kPglRetSuccess) {
       snprintf(errbuf, errbuf_len, "BcfToPgen(\"%s\") failed: %s (code %d)",
@@ -487,8 +501,8 @@ cleanup:
 // non-null (possibly empty) C string, same discipline pgenlib's own
 // possibly-absent-string parameters use elsewhere in this package.
 int rpgen_import_bgen(const char *bgen_path, const char *sample_path,
-                       const char *out_pgen_path, char *errbuf,
-                       size_t errbuf_len) {
+                       const char *out_pgen_path, uint32_t thread_ct,
+                       char *errbuf, size_t errbuf_len) {
   if (errbuf_len > 0) {
     errbuf[0] = '\0';
   }
@@ -560,7 +574,7 @@ int rpgen_import_bgen(const char *bgen_path, const char *sample_path,
         /*idspace_to=*/'\0',              // plink2.cc default
         /*import_max_allele_ct=*/0x7ffffffe,  // plink2.cc default (effectively unlimited)
         /*overlong_varids_mode=*/plink2::kImportOverlongVarIds0,  // plink2.cc default
-        /*max_thread_ct=*/1,  // conservative single-threaded default for a library call
+        /*max_thread_ct=*/thread_ct,  // see kRpgenImportMaxThreads
         outname, outname_end, &chr_info);
     if (reterr != plink2::kPglRetSuccess) {
       snprintf(errbuf, errbuf_len,
@@ -1115,14 +1129,26 @@ static const char *rpgen_import_check_string_or_null(SEXP sexp,
   return rpgen_import_check_string(sexp, argname);
 }
 
+// `threads` for the multithreaded importers: a positive whole number,
+// clipped to kRpgenImportMaxThreads.
+static uint32_t rpgen_import_check_threads(SEXP sexp) {
+  const double value = Rf_length(sexp) == 1 ? Rf_asReal(sexp) : NA_REAL;
+  if (!R_FINITE(value) || value < 1 || value != static_cast<double>(
+                                           static_cast<uint64_t>(value))) {
+    Rf_error("threads must be a positive whole number");
+  }
+  return value > kRpgenImportMaxThreads ? kRpgenImportMaxThreads
+                                        : static_cast<uint32_t>(value);
+}
+
 // See inst/include/Rpgen.h's Rpgen_import_vcf_fun doc comment for the full
 // contract; this just forwards to the implementation above.
 int Rpgen_import_vcf(const char *vcf_path, const char *out_pgen_path,
                       char *errbuf, size_t errbuf_len) {
-  return rpgen_import_vcf(vcf_path, out_pgen_path, errbuf, errbuf_len);
+  return rpgen_import_vcf(vcf_path, out_pgen_path, 1, errbuf, errbuf_len);
 }
 
-SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp) {
+SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp, SEXP threads_sexp) {
   if (TYPEOF(vcf_sexp) != STRSXP || Rf_length(vcf_sexp) != 1 ||
       STRING_ELT(vcf_sexp, 0) == NA_STRING) {
     Rf_error("vcf must be a single non-NA string");
@@ -1133,9 +1159,11 @@ SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp) {
   }
   const char *vcf_path = CHAR(STRING_ELT(vcf_sexp, 0));
   const char *out_pgen_path = CHAR(STRING_ELT(out_sexp, 0));
+  const uint32_t thread_ct = rpgen_import_check_threads(threads_sexp);
 
   char errbuf[512];
-  if (Rpgen_import_vcf(vcf_path, out_pgen_path, errbuf, sizeof(errbuf)) != 0) {
+  if (rpgen_import_vcf(vcf_path, out_pgen_path, thread_ct, errbuf,
+                       sizeof(errbuf)) != 0) {
     Rf_error("rpgen_import_vcf(\"%s\") failed: %s", vcf_path, errbuf);
   }
   return Rf_mkString(out_pgen_path);
@@ -1145,15 +1173,17 @@ SEXP RC_rpgen_import_vcf(SEXP vcf_sexp, SEXP out_sexp) {
 // contract; this just forwards to the implementation above.
 int Rpgen_import_bcf(const char *bcf_path, const char *out_pgen_path,
                       char *errbuf, size_t errbuf_len) {
-  return rpgen_import_bcf(bcf_path, out_pgen_path, errbuf, errbuf_len);
+  return rpgen_import_bcf(bcf_path, out_pgen_path, 1, errbuf, errbuf_len);
 }
 
-SEXP RC_rpgen_import_bcf(SEXP bcf_sexp, SEXP out_sexp) {
+SEXP RC_rpgen_import_bcf(SEXP bcf_sexp, SEXP out_sexp, SEXP threads_sexp) {
   const char *bcf_path = rpgen_import_check_string(bcf_sexp, "bcf");
   const char *out_pgen_path = rpgen_import_check_string(out_sexp, "out");
+  const uint32_t thread_ct = rpgen_import_check_threads(threads_sexp);
 
   char errbuf[512];
-  if (Rpgen_import_bcf(bcf_path, out_pgen_path, errbuf, sizeof(errbuf)) != 0) {
+  if (rpgen_import_bcf(bcf_path, out_pgen_path, thread_ct, errbuf,
+                       sizeof(errbuf)) != 0) {
     Rf_error("rpgen_import_bcf(\"%s\") failed: %s", bcf_path, errbuf);
   }
   return Rf_mkString(out_pgen_path);
@@ -1193,18 +1223,21 @@ int Rpgen_import_bgen(const char *bgen_path, const char *sample_path,
                        const char *out_pgen_path, char *errbuf,
                        size_t errbuf_len) {
   return rpgen_import_bgen(bgen_path, sample_path ? sample_path : "",
-                            out_pgen_path, errbuf, errbuf_len);
+                            out_pgen_path, 1, errbuf, errbuf_len);
 }
 
-SEXP RC_rpgen_import_bgen(SEXP bgen_sexp, SEXP sample_sexp, SEXP out_sexp) {
+SEXP RC_rpgen_import_bgen(SEXP bgen_sexp, SEXP sample_sexp, SEXP out_sexp,
+                          SEXP threads_sexp) {
   const char *bgen_path = rpgen_import_check_string(bgen_sexp, "bgen");
   const char *sample_path =
       rpgen_import_check_string_or_null(sample_sexp, "sample");
   const char *out_pgen_path = rpgen_import_check_string(out_sexp, "out");
+  const uint32_t thread_ct = rpgen_import_check_threads(threads_sexp);
 
   char errbuf[512];
-  if (Rpgen_import_bgen(bgen_path, sample_path, out_pgen_path, errbuf,
-                         sizeof(errbuf)) != 0) {
+  if (rpgen_import_bgen(bgen_path, sample_path ? sample_path : "",
+                        out_pgen_path, thread_ct, errbuf,
+                        sizeof(errbuf)) != 0) {
     Rf_error("rpgen_import_bgen(\"%s\") failed: %s", bgen_path, errbuf);
   }
   return Rf_mkString(out_pgen_path);
@@ -1330,4 +1363,53 @@ SEXP RC_rpgen_import_eigenstrat(SEXP geno_sexp, SEXP ind_sexp,
   return Rf_mkString(out_pgen_path);
 }
 
+// BGZF-compresses `path` to `out` with plink2's multithreaded BGZF writer.
+// The tests and experiments/rpgen_import_threads.R use it to build BGZF
+// inputs, which the VCF importer decompresses on several threads; base R
+// only writes whole-file gzip, which it must inflate serially.
+SEXP RC_rpgen_bgzip(SEXP path_sexp, SEXP out_sexp, SEXP threads_sexp) {
+  const char *path = rpgen_import_check_string(path_sexp, "path");
+  const char *out_path = rpgen_import_check_string(out_sexp, "out");
+  const uint32_t thread_ct = rpgen_import_check_threads(threads_sexp);
+
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    Rf_error("cannot open \"%s\": %s", path, strerror(errno));
+  }
+  char errbuf[512];
+  errbuf[0] = '\0';
+  plink2::BgzfCompressStream bgzf;
+  plink2::PreinitBgzfCompressStream(&bgzf);
+  plink2::PglErr reterr = plink2::InitBgzfCompressStream(out_path, thread_ct,
+                                                         &bgzf);
+  constexpr size_t kChunk = 1 << 20;
+  char *buf = static_cast<char *>(malloc(kChunk));
+  if (reterr != plink2::kPglRetSuccess) {
+    snprintf(errbuf, sizeof(errbuf), "cannot open \"%s\": %s", out_path,
+             rpgen_reterr_str(reterr));
+  } else if (!buf) {
+    snprintf(errbuf, sizeof(errbuf), "out of memory");
+  } else {
+    size_t n;
+    while ((n = fread(buf, 1, kChunk, in)) != 0) {
+      if (plink2::BgzfWrite(buf, n, &bgzf)) {
+        snprintf(errbuf, sizeof(errbuf), "write to \"%s\" failed", out_path);
+        break;
+      }
+    }
+    if (!errbuf[0] && ferror(in)) {
+      snprintf(errbuf, sizeof(errbuf), "read from \"%s\" failed", path);
+    }
+  }
+  free(buf);
+  fclose(in);
+  if (plink2::CleanupBgzfCompressStream(&bgzf, &reterr) && !errbuf[0]) {
+    snprintf(errbuf, sizeof(errbuf), "write to \"%s\" failed", out_path);
+  }
+  if (errbuf[0]) {
+    Rf_error("rpgen_bgzip(): %s", errbuf);
+  }
+  return Rf_mkString(out_path);
+}
+
 }  // extern "C"
@@ -0,0 +1,476 @@
+/*
+ * rpgen_position_index.cpp - (chromosome, position) index of a variant
+ * table, for rpgen_position_index() and rpgen_ingest(index = TRUE).
+ *
+ * The index is one raw payload, normally an fmalloc vector in the runtime
+ * that holds the genotypes, so it lives as long as they do. In native byte
+ * order, like the "pgen" tensor payload in rpgen.cpp:
+ *
+ *   RpgenPosIndexHeader |
+ *   chrom_start: n_chrom + 1 uint32, where each chromosome's entries begin |
+ *   pos: n_variant int32, sorted within each chromosome |
+ *   col: n_variant uint32, the 0-based column of each entry |
+ *   skip: one int32 per kRpgenPosBlock entries, the block's first pos |
+ *   chromosome names, each NUL-terminated
+ *
+ * Chromosomes keep their order of first appearance, and equal positions keep
+ * column order. A lookup finds the chromosome's entries by name, then
+ * binary-searches the skip entries inside them and finally one block of pos.
+ * The skip array is 1/64 the size of pos, so its search stays in cache and
+ * a query reads one or two lines of pos: O(log n) per query, with queries
+ * passed as whole vectors so R pays one .Call per batch.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <R.h>
+#include <Rinternals.h>
+
+namespace {
+
+constexpr char kRpgenPosMagic[8] = {'R', 'P', 'G', 'E', 'N', 'P', 'X', '1'};
+constexpr uint32_t kRpgenPosBlock = 64;
+constexpr uint32_t kRpgenPosSorted = 1;  // entry i is column i
+
+struct RpgenPosIndexHeader {
+  char magic[8];
+  uint32_t n_variant;
+  uint32_t n_chrom;
+  uint32_t flags;
+  uint32_t names_bytes;  // with every NUL
+};
+
+struct RpgenPosIndexView {
+  const RpgenPosIndexHeader *hdr;
+  const uint32_t *chrom_start;
+  const int32_t *pos;
+  const uint32_t *col;
+  const int32_t *skip;
+  const char *names;
+  // Chromosome numbers sorted by name, for lookup_chrom().
+  const uint32_t *by_name;
+  const char **name_ptr;
+};
+
+size_t rpgen_pos_skip_ct(uint32_t n_variant) {
+  return (static_cast<size_t>(n_variant) + kRpgenPosBlock - 1) /
+         kRpgenPosBlock;
+}
+
+size_t rpgen_pos_index_bytes(uint32_t n_variant, uint32_t n_chrom,
+                             uint32_t names_bytes) {
+  return sizeof(RpgenPosIndexHeader) +
+         (static_cast<size_t>(n_chrom) + 1) * sizeof(uint32_t) +
+         static_cast<size_t>(n_variant) * (sizeof(int32_t) + sizeof(uint32_t)) +
+         rpgen_pos_skip_ct(n_variant) * sizeof(int32_t) + names_bytes;
+}
+
+// Checks that index is a payload RC_rpgen_position_index() filled and
+// returns its arrays. The name lookup table is R_alloc()ed for this call.
+RpgenPosIndexView rpgen_pos_view(SEXP index) {
+  RpgenPosIndexView v;
+  const size_t len = TYPEOF(index) == RAWSXP ? XLENGTH(index) : 0;
+  if (len < sizeof(RpgenPosIndexHeader)) {
+    Rf_error("index must be an rpgen_position_index");
+  }
+  const uint8_t *p = RAW(index);
+  v.hdr = reinterpret_cast<const RpgenPosIndexHeader *>(p);
+  if (std::memcmp(v.hdr->magic, kRpgenPosMagic, sizeof(kRpgenPosMagic)) != 0 ||
+      len < rpgen_pos_index_bytes(v.hdr->n_variant, v.hdr->n_chrom,
+                                  v.hdr->names_bytes)) {
+    Rf_error("index must be an rpgen_position_index");
+  }
+  const uint32_t n = v.hdr->n_variant;
+  p += sizeof(RpgenPosIndexHeader);
+  v.chrom_start = reinterpret_cast<const uint32_t *>(p);
+  p += (static_cast<size_t>(v.hdr->n_chrom) + 1) * sizeof(uint32_t);
+  v.pos = reinterpret_cast<const int32_t *>(p);
+  p += static_cast<size_t>(n) * sizeof(int32_t);
+  v.col = reinterpret_cast<const uint32_t *>(p);
+  p += static_cast<size_t>(n) * sizeof(uint32_t);
+  v.skip = reinterpret_cast<const int32_t *>(p);
+  p += rpgen_pos_skip_ct(n) * sizeof(int32_t);
+  v.names = reinterpret_cast<const char *>(p);
+
+  const uint32_t n_chrom = v.hdr->n_chrom;
+  const char **name_ptr =
+      reinterpret_cast<const char **>(R_alloc(n_chrom + 1, sizeof(char *)));
+  const char *name = v.names;
+  const char *names_end = v.names + v.hdr->names_bytes;
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    const void *nul = std::memchr(name, 0, names_end - name);
+    if (!nul) {
+      Rf_error("index must be an rpgen_position_index");
+    }
+    name_ptr[c] = name;
+    name = static_cast<const char *>(nul) + 1;
+  }
+  uint32_t *by_name =
+      reinterpret_cast<uint32_t *>(R_alloc(n_chrom + 1, sizeof(uint32_t)));
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    by_name[c] = c;
+  }
+  std::sort(by_name, by_name + n_chrom, [name_ptr](uint32_t a, uint32_t b) {
+    return std::strcmp(name_ptr[a], name_ptr[b]) < 0;
+  });
+  v.by_name = by_name;
+  v.name_ptr = name_ptr;
+  return v;
+}
+
+// The chromosome number of name, or UINT32_MAX if the index has none.
+uint32_t lookup_chrom(const RpgenPosIndexView &v, const char *name) {
+  const uint32_t *end = v.by_name + v.hdr->n_chrom;
+  const uint32_t *it = std::lower_bound(
+      v.by_name, end, name, [&v](uint32_t c, const char *s) {
+        return std::strcmp(v.name_ptr[c], s) < 0;
+      });
+  if (it == end || std::strcmp(v.name_ptr[*it], name) != 0) {
+    return UINT32_MAX;
+  }
+  return *it;
+}
+
+// Repeated chromosome names are usually one cached CHARSXP, so the previous
+// lookup answers most queries of a batch.
+struct RpgenChromCache {
+  SEXP last = R_NilValue;
+  uint32_t chrom = UINT32_MAX;
+};
+
+uint32_t lookup_chrom(const RpgenPosIndexView &v, SEXP name,
+                      RpgenChromCache *cache) {
+  if (name != cache->last) {
+    cache->last = name;
+    cache->chrom =
+        name == NA_STRING ? UINT32_MAX : lookup_chrom(v, CHAR(name));
+  }
+  return cache->chrom;
+}
+
+// The least position a bound of x admits: ceil(x), clamped to int32 plus one
+// past either end so that it still orders against every position.
+int64_t bound_at_least(double x) {
+  if (x <= INT32_MIN) {
+    return INT32_MIN;
+  }
+  if (x > INT32_MAX) {
+    return static_cast<int64_t>(INT32_MAX) + 1;
+  }
+  return static_cast<int64_t>(std::ceil(x));
+}
+
+// The first entry in [lo, hi), all of one chromosome, whose position is at
+// least key, or hi. The skip entries of the blocks that start inside the
+// range narrow it to at most two blocks before the final search.
+uint32_t lower_bound_pos(const RpgenPosIndexView &v, uint32_t lo, uint32_t hi,
+                         int64_t key) {
+  if (lo >= hi) {
+    return hi;
+  }
+  const uint32_t b_first = lo / kRpgenPosBlock + 1;
+  const uint32_t b_last = (hi - 1) / kRpgenPosBlock;
+  uint32_t l = b_first;
+  uint32_t r = b_last + 1;
+  while (l < r) {
+    const uint32_t m = l + (r - l) / 2;
+    if (v.skip[m] >= key) {
+      r = m;
+    } else {
+      l = m + 1;
+    }
+  }
+  const uint32_t s = l == b_first ? lo : (l - 1) * kRpgenPosBlock;
+  const uint32_t e = l > b_last ? hi : l * kRpgenPosBlock;
+  return static_cast<uint32_t>(
+      std::lower_bound(v.pos + s, v.pos + e, key,
+                       [](int32_t p, int64_t k) { return p < k; }) -
+      v.pos);
+}
+
+// The entries [*lo, *hi) of chromosome c with start <= pos <= end.
+void pos_range(const RpgenPosIndexView &v, uint32_t c, double start,
+               double end, uint32_t *lo, uint32_t *hi) {
+  const uint32_t a = v.chrom_start[c];
+  const uint32_t b = v.chrom_start[c + 1];
+  if (std::isnan(start) || std::isnan(end) || end < start) {
+    *lo = *hi = a;
+    return;
+  }
+  *lo = lower_bound_pos(v, a, b, bound_at_least(start));
+  // First position past end: floor(end) + 1, clamped the same way.
+  *hi = lower_bound_pos(v, *lo, b,
+                        end >= INT32_MAX ? static_cast<int64_t>(INT32_MAX) + 1
+                                         : bound_at_least(std::floor(end) + 1));
+}
+
+R_xlen_t check_queries(SEXP chrom, SEXP a, SEXP b) {
+  const R_xlen_t n = XLENGTH(chrom);
+  if (TYPEOF(chrom) != STRSXP || TYPEOF(a) != REALSXP || XLENGTH(a) != n ||
+      (b != R_NilValue && (TYPEOF(b) != REALSXP || XLENGTH(b) != n))) {
+    Rf_error("queries must be a character vector and doubles of its length");
+  }
+  return n;
+}
+
+}  // namespace
+
+// With payload = NULL, the bytes the index of this table takes. Otherwise
+// fills payload, a raw vector at least that long, and returns it. codes are
+// 1-based chromosome numbers into chroms, one per variant, and pos the
+// variants' positions; column j of the index is variant j.
+extern "C" SEXP RC_rpgen_position_index(SEXP codes_sexp, SEXP pos_sexp,
+                                        SEXP chroms_sexp, SEXP payload) {
+  if (TYPEOF(codes_sexp) != INTSXP || TYPEOF(pos_sexp) != INTSXP ||
+      TYPEOF(chroms_sexp) != STRSXP ||
+      XLENGTH(codes_sexp) != XLENGTH(pos_sexp)) {
+    Rf_error("codes and pos must be integer vectors of one length");
+  }
+  const R_xlen_t n_xlen = XLENGTH(pos_sexp);
+  const R_xlen_t n_chrom_xlen = XLENGTH(chroms_sexp);
+  if (n_xlen >= INT_MAX || n_chrom_xlen >= INT_MAX) {
+    Rf_error("a position index holds fewer than 2^31 variants");
+  }
+  const uint32_t n = static_cast<uint32_t>(n_xlen);
+  const uint32_t n_chrom = static_cast<uint32_t>(n_chrom_xlen);
+  size_t names_bytes = 0;
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    SEXP name = STRING_ELT(chroms_sexp, c);
+    if (name == NA_STRING) {
+      Rf_error("chromosome names must not be NA");
+    }
+    names_bytes += std::strlen(CHAR(name)) + 1;
+  }
+  if (names_bytes >= UINT32_MAX) {
+    Rf_error("chromosome names are too long");
+  }
+  const size_t bytes = rpgen_pos_index_bytes(
+      n, n_chrom, static_cast<uint32_t>(names_bytes));
+  if (payload == R_NilValue) {
+    return Rf_ScalarReal(static_cast<double>(bytes));
+  }
+  if (TYPEOF(payload) != RAWSXP ||
+      static_cast<size_t>(XLENGTH(payload)) < bytes) {
+    Rf_error("payload must be a raw vector of at least %.0f bytes",
+             static_cast<double>(bytes));
+  }
+  const int *codes = INTEGER(codes_sexp);
+  const int *pos_in = INTEGER(pos_sexp);
+  for (uint32_t j = 0; j != n; ++j) {
+    if (codes[j] == NA_INTEGER || codes[j] < 1 ||
+        static_cast<uint32_t>(codes[j]) > n_chrom) {
+      Rf_error("codes must be chromosome numbers between 1 and %u", n_chrom);
+    }
+    if (pos_in[j] == NA_INTEGER) {
+      Rf_error("variant %u has no position", j + 1);
+    }
+  }
+
+  RpgenPosIndexHeader h;
+  std::memcpy(h.magic, kRpgenPosMagic, sizeof(h.magic));
+  h.n_variant = n;
+  h.n_chrom = n_chrom;
+  h.flags = 0;
+  h.names_bytes = static_cast<uint32_t>(names_bytes);
+  uint8_t *dst = RAW(payload);
+  std::memset(dst, 0, bytes);
+  std::memcpy(dst, &h, sizeof(h));
+  uint8_t *p = dst + sizeof(h);
+  uint32_t *chrom_start = reinterpret_cast<uint32_t *>(p);
+  p += (static_cast<size_t>(n_chrom) + 1) * sizeof(uint32_t);
+  int32_t *pos = reinterpret_cast<int32_t *>(p);
+  p += static_cast<size_t>(n) * sizeof(int32_t);
+  uint32_t *col = reinterpret_cast<uint32_t *>(p);
+  p += static_cast<size_t>(n) * sizeof(uint32_t);
+  int32_t *skip = reinterpret_cast<int32_t *>(p);
+  p += rpgen_pos_skip_ct(n) * sizeof(int32_t);
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    const char *name = CHAR(STRING_ELT(chroms_sexp, c));
+    const size_t len = std::strlen(name) + 1;
+    std::memcpy(p, name, len);
+    p += len;
+  }
+
+  // Bucket the columns by chromosome, which keeps them in column order, then
+  // sort each chromosome by position unless the file already is.
+  for (uint32_t j = 0; j != n; ++j) {
+    ++chrom_start[codes[j]];
+  }
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    chrom_start[c + 1] += chrom_start[c];
+  }
+  for (uint32_t j = 0; j != n; ++j) {
+    col[chrom_start[codes[j] - 1]++] = j;
+  }
+  for (uint32_t c = n_chrom; c != 0; --c) {
+    chrom_start[c] = chrom_start[c - 1];
+  }
+  chrom_start[0] = 0;
+  bool sorted = true;
+  for (uint32_t c = 0; c != n_chrom; ++c) {
+    uint32_t *first = col + chrom_start[c];
+    uint32_t *last = col + chrom_start[c + 1];
+    const auto by_pos = [pos_in](uint32_t a, uint32_t b) {
+      return pos_in[a] < pos_in[b];
+    };
+    if (!std::is_sorted(first, last, by_pos)) {
+      std::stable_sort(first, last, by_pos);
+    }
+  }
+  for (uint32_t i = 0; i != n; ++i) {
+    pos[i] = pos_in[col[i]];
+    sorted = sorted && col[i] == i;
+  }
+  for (size_t b = 0; b != rpgen_pos_skip_ct(n); ++b) {
+    skip[b] = pos[b * kRpgenPosBlock];
+  }
+  if (sorted) {
+    reinterpret_cast<RpgenPosIndexHeader *>(dst)->flags |= kRpgenPosSorted;
+  }
+  return payload;
+}
+
+// list(n_variant, chroms, sorted) of an index.
+extern "C" SEXP RC_rpgen_position_info(SEXP index) {
+  const RpgenPosIndexView v = rpgen_pos_view(index);
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(out, 0, Rf_ScalarReal(v.hdr->n_variant));
+  SEXP chroms = Rf_allocVector(STRSXP, v.hdr->n_chrom);
+  SET_VECTOR_ELT(out, 1, chroms);
+  for (uint32_t c = 0; c != v.hdr->n_chrom; ++c) {
+    SET_STRING_ELT(chroms, c, Rf_mkChar(v.name_ptr[c]));
+  }
+  SET_VECTOR_ELT(out, 2,
+                 Rf_ScalarLogical((v.hdr->flags & kRpgenPosSorted) != 0));
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, 3));
+  SET_STRING_ELT(names, 0, Rf_mkChar("n_variant"));
+  SET_STRING_ELT(names, 1, Rf_mkChar("chroms"));
+  SET_STRING_ELT(names, 2, Rf_mkChar("sorted"));
+  Rf_setAttrib(out, R_NamesSymbol, names);
+  UNPROTECT(2);
+  return out;
+}
+
+// The sorted 1-based columns of the variants in any interval
+// chrom[q]:start[q]-end[q]. Unknown chromosomes match nothing.
+extern "C" SEXP RC_rpgen_position_region(SEXP index, SEXP chrom_sexp,
+                                         SEXP start_sexp, SEXP end_sexp) {
+  const RpgenPosIndexView v = rpgen_pos_view(index);
+  const R_xlen_t n_query = check_queries(chrom_sexp, start_sexp, end_sexp);
+  const double *start = REAL(start_sexp);
+  const double *end = REAL(end_sexp);
+  uint32_t *range = reinterpret_cast<uint32_t *>(
+      R_alloc(2 * n_query + 1, sizeof(uint32_t)));
+  RpgenChromCache cache;
+  size_t total = 0;
+  for (R_xlen_t q = 0; q != n_query; ++q) {
+    const uint32_t c = lookup_chrom(v, STRING_ELT(chrom_sexp, q), &cache);
+    if (c == UINT32_MAX) {
+      range[2 * q] = range[2 * q + 1] = 0;
+      continue;
+    }
+    pos_range(v, c, start[q], end[q], &range[2 * q], &range[2 * q + 1]);
+    total += range[2 * q + 1] - range[2 * q];
+  }
+  if (total > static_cast<size_t>(R_XLEN_T_MAX)) {
+    Rf_error("the regions select too many variants");
+  }
+  uint32_t *cols =
+      reinterpret_cast<uint32_t *>(R_alloc(total + 1, sizeof(uint32_t)));
+  size_t k = 0;
+  for (R_xlen_t q = 0; q != n_query; ++q) {
+    for (uint32_t i = range[2 * q]; i != range[2 * q + 1]; ++i) {
+      cols[k++] = v.col[i];
+    }
+  }
+  // One region of a sorted index is already in column order.
+  if (n_query > 1 || !(v.hdr->flags & kRpgenPosSorted)) {
+    std::sort(cols, cols + k);
+    k = std::unique(cols, cols + k) - cols;
+  }
+  SEXP out = PROTECT(Rf_allocVector(INTSXP, k));
+  int *dst = INTEGER(out);
+  for (size_t i = 0; i != k; ++i) {
+    dst[i] = static_cast<int>(cols[i]) + 1;
+  }
+  UNPROTECT(1);
+  return out;
+}
+
+// The 1-based column of the variant nearest each chrom[q]:pos[q], the
+// lower position on a tie and the lower column among equal positions. NA
+// for an unknown chromosome or an NA position.
+extern "C" SEXP RC_rpgen_position_nearest(SEXP index, SEXP chrom_sexp,
+                                          SEXP pos_sexp) {
+  const RpgenPosIndexView v = rpgen_pos_view(index);
+  const R_xlen_t n_query = check_queries(chrom_sexp, pos_sexp, R_NilValue);
+  const double *query = REAL(pos_sexp);
+  SEXP out = PROTECT(Rf_allocVector(INTSXP, n_query));
+  int *dst = INTEGER(out);
+  RpgenChromCache cache;
+  for (R_xlen_t q = 0; q != n_query; ++q) {
+    const uint32_t c = lookup_chrom(v, STRING_ELT(chrom_sexp, q), &cache);
+    const uint32_t a = c == UINT32_MAX ? 0 : v.chrom_start[c];
+    const uint32_t b = c == UINT32_MAX ? 0 : v.chrom_start[c + 1];
+    if (a == b || std::isnan(query[q])) {
+      dst[q] = NA_INTEGER;
+      continue;
+    }
+    const uint32_t i = lower_bound_pos(v, a, b, bound_at_least(query[q]));
+    uint32_t best = i;
+    if (i == b) {
+      best = lower_bound_pos(v, a, b, v.pos[b - 1]);
+    } else if (i != a) {
+      const uint32_t j = lower_bound_pos(v, a, i, v.pos[i - 1]);
+      if (query[q] - v.pos[j] <= v.pos[i] - query[q]) {
+        best = j;
+      }
+    }
+    dst[q] = static_cast<int>(v.col[best]) + 1;
+  }
+  UNPROTECT(1);
+  return out;
+}
+
+// list(from, to): for each interval chrom[q]:start[q]-end[q], the first and
+// last 1-based column inside it, with to = from - 1 when it holds none and
+// both NA for an unknown chromosome. The columns of a window are contiguous
+// only when the index is sorted, so the index must be.
+extern "C" SEXP RC_rpgen_position_window(SEXP index, SEXP chrom_sexp,
+                                         SEXP start_sexp, SEXP end_sexp) {
+  const RpgenPosIndexView v = rpgen_pos_view(index);
+  if (!(v.hdr->flags & kRpgenPosSorted)) {
+    Rf_error("windows need variants sorted by chromosome and position");
+  }
+  const R_xlen_t n_query = check_queries(chrom_sexp, start_sexp, end_sexp);
+  const double *start = REAL(start_sexp);
+  const double *end = REAL(end_sexp);
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, 2));
+  SEXP from = Rf_allocVector(INTSXP, n_query);
+  SET_VECTOR_ELT(out, 0, from);
+  SEXP to = Rf_allocVector(INTSXP, n_query);
+  SET_VECTOR_ELT(out, 1, to);
+  RpgenChromCache cache;
+  for (R_xlen_t q = 0; q != n_query; ++q) {
+    const uint32_t c = lookup_chrom(v, STRING_ELT(chrom_sexp, q), &cache);
+    if (c == UINT32_MAX) {
+      INTEGER(from)[q] = INTEGER(to)[q] = NA_INTEGER;
+      continue;
+    }
+    uint32_t lo;
+    uint32_t hi;
+    pos_range(v, c, start[q], end[q], &lo, &hi);
+    INTEGER(from)[q] = static_cast<int>(lo) + 1;
+    INTEGER(to)[q] = static_cast<int>(hi);
+  }
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, 2));
+  SET_STRING_ELT(names, 0, Rf_mkChar("from"));
+  SET_STRING_ELT(names, 1, Rf_mkChar("to"));
+  Rf_setAttrib(out, R_NamesSymbol, names);
+  UNPROTECT(2);
+  return out;
+}
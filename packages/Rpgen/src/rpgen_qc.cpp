@@ -0,0 +1,301 @@
+/*
+ * rpgen_qc.cpp - genotype QC counts for rpgen_ingest(qc = TRUE).
+ *
+ * See rpgen_qc.h for how the counts are kept. This file has no state of its
+ * own: callers own the counters and the per-variant count array.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "include/plink2_bits.h"  // NypCtToWordCt, PopcountWord, ctzw
+
+// See rpgen.cpp's identical comment: plink2's headers #define FALSE/TRUE as
+// int macros, which shadow R's Rboolean enumerators.
+#ifdef FALSE
+#  undef FALSE
+#endif
+#ifdef TRUE
+#  undef TRUE
+#endif
+
+#include "rpgen_qc.h"
+
+namespace {
+
+// Lane words per genovec word: 4 of 4-bit lanes, then 8 of 8-bit lanes.
+constexpr uint32_t kLaneWords = 12;
+
+// Records the 4-bit and the 8-bit lanes can hold.
+constexpr uint32_t kNibbleRecords = 15;
+constexpr uint32_t kByteRecords = 255;
+
+// HWE probability terms below this fraction of the running sum are dropped.
+// Terms fall off faster than geometrically away from the mode, so the sums
+// stop after O(sqrt(n)) terms instead of enumerating every het count.
+constexpr double kHweEpsilon = 1e-17;
+
+// Log-scale slack when deciding that a het count is no likelier than the
+// observed one, so exact ties are not lost to lgamma() rounding.
+constexpr double kHweTieSlack = 1e-9;
+
+// Log of the unnormalized probability of `het` heterozygotes given `rare`
+// and `common` allele copies (Wigginton et al., eq. 2): 2^het divided by
+// het!, the rare homozygote count's factorial and the common one's.
+double hwe_log_weight(double het, double rare, double common) {
+  return het * M_LN2 - std::lgamma(het + 1) -
+         std::lgamma((rare - het) / 2 + 1) -
+         std::lgamma((common - het) / 2 + 1);
+}
+
+// P(het + 2) / P(het).
+double hwe_ratio_up(double het, double rare, double common) {
+  return ((rare - het) * (common - het)) / ((het + 1) * (het + 2));
+}
+
+// P(het - 2) / P(het).
+double hwe_ratio_down(double het, double rare, double common) {
+  return (het * (het - 1)) / ((rare - het + 2) * (common - het + 2));
+}
+
+// first + the terms after it, walking from `het` by `step` (+2 or -2) while
+// the het count stays within [0, rare]. Terms are relative to P(het) scaled
+// by first; they only shrink along a walk away from the mode.
+double hwe_tail(double het, double first, int step, double rare,
+                double common) {
+  double sum = first;
+  double term = first;
+  for (double h = het; step > 0 ? h + 2 <= rare : h >= 2; h += step) {
+    term *= step > 0 ? hwe_ratio_up(h, rare, common)
+                     : hwe_ratio_down(h, rare, common);
+    sum += term;
+    if (term < sum * kHweEpsilon) {
+      break;
+    }
+  }
+  return sum;
+}
+
+// Adds the 4-bit lanes into the 8-bit lanes and clears them. Lane word k
+// (k < 4) holds mask bit 4j+k in nibble j; lane words 4+2k and 5+2k take
+// its even and odd nibbles, so byte i of each holds bit 8i+k and 8i+4+k.
+void spill_nibbles(RpgenQcCounter *c) {
+  uintptr_t *lane = c->lanes.data();
+  for (uint32_t w = 0; w != c->word_ct; ++w, lane += kLaneWords) {
+    for (uint32_t k = 0; k != 4; ++k) {
+      lane[4 + 2 * k] += lane[k] & plink2::kMask0F0F;
+      lane[5 + 2 * k] += (lane[k] >> 4) & plink2::kMask0F0F;
+      lane[k] = 0;
+    }
+  }
+  c->byte_ct += c->nibble_ct;
+  c->nibble_ct = 0;
+}
+
+// Adds the 8-bit lanes into the per-sample totals and clears them.
+void fold_bytes(RpgenQcCounter *c) {
+  uintptr_t *lane = c->lanes.data();
+  for (uint32_t w = 0; w != c->word_ct; ++w, lane += kLaneWords) {
+    for (uint32_t k = 0; k != 8; ++k) {
+      const uintptr_t counts = lane[4 + k];
+      lane[4 + k] = 0;
+      if (!counts) {
+        continue;
+      }
+      for (uint32_t i = 0; i != plink2::kBytesPerWord; ++i) {
+        const uint32_t bit = 8 * i + 4 * (k & 1) + k / 2;
+        const uint32_t s = w * plink2::kBitsPerWordD2 + bit / 2;
+        const uint32_t n = (counts >> (8 * i)) & 0xff;
+        if (n) {
+          (bit & 1 ? c->missing : c->het)[s] += n;
+        }
+      }
+    }
+  }
+  c->byte_ct = 0;
+}
+
+}  // namespace
+
+void rpgen_qc_counter_init(RpgenQcCounter *c, uint32_t n_sample) {
+  c->n_sample = n_sample;
+  c->word_ct = plink2::NypCtToWordCt(n_sample);
+  c->nibble_ct = 0;
+  c->byte_ct = 0;
+  c->lanes.assign(static_cast<size_t>(c->word_ct) * kLaneWords, 0);
+  c->het.assign(n_sample, 0);
+  c->missing.assign(n_sample, 0);
+}
+
+void rpgen_qc_add(RpgenQcCounter *c, const uintptr_t *genovec,
+                  uint32_t *variant_counts) {
+  const uint32_t word_ct = c->word_ct;
+  const uint32_t tail = c->n_sample % plink2::kBitsPerWordD2;
+  const uintptr_t tail_mask =
+      tail ? (~static_cast<uintptr_t>(0)) >> (plink2::kBitsPerWord - 2 * tail)
+           : ~static_cast<uintptr_t>(0);
+  uintptr_t *lane = c->lanes.data();
+  uint32_t het_ct = 0;
+  uint32_t alt_ct = 0;
+  uint32_t missing_ct = 0;
+  for (uint32_t w = 0; w != word_ct; ++w, lane += kLaneWords) {
+    uintptr_t geno = genovec[w];
+    if (w + 1 == word_ct) {
+      geno &= tail_mask;
+    }
+    const uintptr_t lo = geno & plink2::kMask5555;
+    const uintptr_t hi = (geno >> 1) & plink2::kMask5555;
+    const uintptr_t het = lo & ~hi;
+    const uintptr_t missing = lo & hi;
+    het_ct += plink2::PopcountWord(het);
+    alt_ct += plink2::PopcountWord(hi & ~lo);
+    missing_ct += plink2::PopcountWord(missing);
+    const uintptr_t flagged = het | (missing << 1);
+    lane[0] += flagged & plink2::kMask1111;
+    lane[1] += (flagged >> 1) & plink2::kMask1111;
+    lane[2] += (flagged >> 2) & plink2::kMask1111;
+    lane[3] += (flagged >> 3) & plink2::kMask1111;
+  }
+  variant_counts[0] = c->n_sample - het_ct - alt_ct - missing_ct;
+  variant_counts[1] = het_ct;
+  variant_counts[2] = alt_ct;
+  variant_counts[3] = missing_ct;
+  if (++c->nibble_ct == kNibbleRecords) {
+    spill_nibbles(c);
+    if (c->byte_ct + kNibbleRecords > kByteRecords) {
+      fold_bytes(c);
+    }
+  }
+}
+
+void rpgen_qc_fold(RpgenQcCounter *c) {
+  if (c->nibble_ct) {
+    spill_nibbles(c);
+  }
+  if (c->byte_ct) {
+    fold_bytes(c);
+  }
+}
+
+void rpgen_qc_merge(RpgenQcCounter *into, RpgenQcCounter *from) {
+  rpgen_qc_fold(into);
+  rpgen_qc_fold(from);
+  for (uint32_t s = 0; s != into->n_sample; ++s) {
+    into->het[s] += from->het[s];
+    into->missing[s] += from->missing[s];
+  }
+}
+
+// The p-value is the probability, under HWE with these allele counts, of a
+// het count no likelier than the observed one. Rather than enumerate every
+// het count, it finds the mode, sums the distribution outward from it, and
+// sums the two tails from the observed count and from the first count on
+// the mode's other side (the mode included) that is no likelier. That start
+// comes from a binary search on hwe_log_weight(), so a far-off observation
+// does not cost a walk across the whole range.
+double rpgen_qc_hwe_p(uint32_t het, uint32_t hom1, uint32_t hom2) {
+  const double n = static_cast<double>(het) + hom1 + hom2;
+  if (n == 0) {
+    return NA_REAL;
+  }
+  const double a1 = 2.0 * hom1 + het;
+  const double a2 = 2.0 * hom2 + het;
+  const double rare = a1 < a2 ? a1 : a2;
+  const double common = a1 < a2 ? a2 : a1;
+  if (rare == 0) {
+    return 1;
+  }
+
+  // Het counts share rare's parity. Start near the expected count and climb.
+  double mode = std::floor(rare * common / (2 * n - 1));
+  if (std::fmod(rare - mode, 2) != 0) {
+    mode += 1;
+  }
+  if (mode > rare) {
+    mode -= 2;
+  }
+  while (mode + 2 <= rare && hwe_ratio_up(mode, rare, common) > 1) {
+    mode += 2;
+  }
+  while (mode >= 2 && hwe_ratio_down(mode, rare, common) > 1) {
+    mode -= 2;
+  }
+  const double obs = het;
+  if (obs == mode) {
+    return 1;
+  }
+  const double total = hwe_tail(mode, 1, 2, rare, common) +
+                       hwe_tail(mode, 1, -2, rare, common) - 1;
+
+  const double log_obs = hwe_log_weight(obs, rare, common);
+  const int own = obs < mode ? -2 : 2;
+  double sum = hwe_tail(obs, 1, own, rare, common);
+
+  const int other = -own;
+  const double step_ct = other > 0 ? (rare - mode) / 2 : mode / 2;
+  const double limit = log_obs + kHweTieSlack;
+  // Searched from the mode itself, which can tie with its neighbour.
+  if (hwe_log_weight(mode + other * step_ct, rare, common) <= limit) {
+    double lo = 0;
+    double hi = step_ct;
+    while (lo < hi) {
+      const double mid = std::floor((lo + hi) / 2);
+      if (hwe_log_weight(mode + other * mid, rare, common) <= limit) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    const double start = mode + other * lo;
+    sum += hwe_tail(start,
+                    std::exp(hwe_log_weight(start, rare, common) - log_obs),
+                    other, rare, common);
+  }
+  const double p = sum *
+      std::exp(log_obs - hwe_log_weight(mode, rare, common)) / total;
+  return p < 1 ? p : 1;
+}
+
+SEXP rpgen_qc_result(uint32_t n_variant, const uint32_t *variant_counts,
+                     RpgenQcCounter *c) {
+  rpgen_qc_fold(c);
+  static const char *const kNames[] = {
+      "n_hom_ref", "n_het", "n_hom_alt", "n_missing",
+      "hwe_p", "sample_missing", "sample_het"};
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, 7));
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, 7));
+  for (int i = 0; i != 7; ++i) {
+    SET_STRING_ELT(names, i, Rf_mkChar(kNames[i]));
+  }
+  Rf_setAttrib(out, R_NamesSymbol, names);
+
+  for (int k = 0; k != 4; ++k) {
+    SEXP counts = Rf_allocVector(INTSXP, n_variant);
+    SET_VECTOR_ELT(out, k, counts);
+    int *dst = INTEGER(counts);
+    for (uint32_t v = 0; v != n_variant; ++v) {
+      dst[v] = static_cast<int>(variant_counts[(size_t)v * 4 + k]);
+    }
+  }
+  SEXP hwe = Rf_allocVector(REALSXP, n_variant);
+  SET_VECTOR_ELT(out, 4, hwe);
+  for (uint32_t v = 0; v != n_variant; ++v) {
+    const uint32_t *vc = variant_counts + (size_t)v * 4;
+    REAL(hwe)[v] = rpgen_qc_hwe_p(vc[1], vc[0], vc[2]);
+  }
+
+  SEXP missing = Rf_allocVector(INTSXP, c->n_sample);
+  SET_VECTOR_ELT(out, 5, missing);
+  SEXP het = Rf_allocVector(INTSXP, c->n_sample);
+  SET_VECTOR_ELT(out, 6, het);
+  for (uint32_t s = 0; s != c->n_sample; ++s) {
+    INTEGER(missing)[s] = static_cast<int>(c->missing[s]);
+    INTEGER(het)[s] = static_cast<int>(c->het[s]);
+  }
+  UNPROTECT(2);
+  return out;
+}
@@ -0,0 +1,67 @@
+#ifndef RPGEN_QC_H
+#define RPGEN_QC_H
+
+/*
+ * Genotype QC counts accumulated while rpgen_ingest() streams records.
+ *
+ * Both ingest paths see every record as a PLINK 2 genovec (2 bits per
+ * sample: 0 hom-ref, 1 het, 2 hom-alt, 3 missing) before it is written:
+ * the pgenlib decoders in rpgen.cpp and the direct sink behind the vendored
+ * importers. Counting from that genovec costs a few word operations per 32
+ * samples, so QC needs no second pass over the data.
+ *
+ * Per-variant counts are popcounts of the genovec's het, hom-alt and
+ * missing masks. Per-sample het and missing counts are vertical counters,
+ * as in plink2's own per-sample tallies: a genovec word's het and missing
+ * bits are spread over four words of 4-bit lanes, so one record adds to 32
+ * samples' counts with a few shifts, masks and adds and no branch. The
+ * lanes spill into 8-bit lanes every 15 records, and those into plain
+ * per-sample totals every 255.
+ *
+ * A counter belongs to one thread. Variant counts go to disjoint slots of a
+ * shared array, so decoding threads never share a write.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Rinternals.h>
+
+struct RpgenQcCounter {
+  uint32_t n_sample;
+  uint32_t word_ct;        // genovec words per record
+  uint32_t nibble_ct;      // records in the 4-bit lanes, at most 15
+  uint32_t byte_ct;        // records in the 8-bit lanes, at most 255
+  // Per genovec word, 4 words of 4-bit lanes then 8 words of 8-bit lanes.
+  // Within a word, mask bit 2s counts sample s's hets and bit 2s+1 its
+  // missing calls; rpgen_qc.cpp's spill_nibbles() says which lane holds which.
+  std::vector<uintptr_t> lanes;
+  std::vector<uint32_t> het;
+  std::vector<uint32_t> missing;
+};
+
+// Sizes c for n_sample samples with every count zero. Throws std::bad_alloc.
+void rpgen_qc_counter_init(RpgenQcCounter *c, uint32_t n_sample);
+
+// Adds one record to c and stores its hom-ref, het, hom-alt and missing
+// counts in variant_counts[0..3]. Bits past n_sample are ignored.
+void rpgen_qc_add(RpgenQcCounter *c, const uintptr_t *genovec,
+                  uint32_t *variant_counts);
+
+// Moves the lane counts into c->het and c->missing.
+void rpgen_qc_fold(RpgenQcCounter *c);
+
+// Adds from's sample counts to into's, for counters of different threads.
+void rpgen_qc_merge(RpgenQcCounter *into, RpgenQcCounter *from);
+
+// Two-sided exact Hardy-Weinberg p-value (Wigginton, Cutler and Abecasis
+// 2005) for the given genotype counts; NA_REAL with no calls.
+double rpgen_qc_hwe_p(uint32_t het, uint32_t hom1, uint32_t hom2);
+
+// Folds c and returns list(n_hom_ref, n_het, n_hom_alt, n_missing, hwe_p,
+// sample_missing, sample_het). variant_counts holds 4 counts per variant.
+SEXP rpgen_qc_result(uint32_t n_variant, const uint32_t *variant_counts,
+                     RpgenQcCounter *c);
+
+#endif /* RPGEN_QC_H */